@@ -0,0 +1,71 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Poisson bootstrap: each event is given an independent Poisson(1) weight in each of N replicas, and every histogram
+// is filled once per replica with the jet weight scaled by the event's replica weight. The spread of a bin across
+// replicas estimates its statistical uncertainty.
+
+// Hash of (seed, event, replica) to a uniform double in [0, 1). Weights depend only on these, not on the order in
+// which events are processed, so split, resumed, or reordered runs give the same replicas. `event` is the event's
+// position in the input, which readers pass to CutJetsProcessor::beginEvent() explicitly.
+inline double bootstrapUniform(long long seed, uint64_t event, uint64_t replica) {
+    auto mix = [](uint64_t x) {  // splitmix64 finalizer
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    };
+    uint64_t h = mix(mix(mix(uint64_t(seed) + 0x9e3779b97f4a7c15) ^ event) + replica);
+    return (h >> 11) * 0x1.0p-53;
+}
+
+// Fill `out` with the Poisson(1) replica weights of an event
+inline void bootstrapWeights(long long seed, uint64_t event, std::vector<double>& out) {
+    // Cumulative distribution of Poisson(1), by inversion; beyond 18 the remaining probability is below 2^-53
+    static const std::array<double, 19> cdf = [] {
+        std::array<double, 19> cdf{};
+        double p = std::exp(-1.0);
+        double sum = 0;
+        for (size_t k = 0; k < cdf.size(); k++) {
+            sum += p;
+            cdf[k] = sum;
+            p /= k + 1;
+        }
+        return cdf;
+    }();
+
+    for (size_t r = 0; r < out.size(); r++) {
+        double u = bootstrapUniform(seed, event, r);
+        size_t k = 0;
+        while (k < cdf.size() - 1 && u >= cdf[k]) {
+            k++;
+        }
+        out[r] = k;
+    }
+}
+
+// Sample standard deviation across replicas of a bin's normalized value, sums[r] / scale / totals[r]
+inline double replicaSpread(const double* sums, const std::vector<double>& totals, double scale) {
+    size_t n = totals.size();
+    if (n < 2) {
+        return 0;
+    }
+    double mean = 0;
+    for (size_t r = 0; r < n; r++) {
+        mean += sums[r] / scale / totals[r];
+    }
+    mean /= n;
+    double sumSq = 0;
+    for (size_t r = 0; r < n; r++) {
+        double d = sums[r] / scale / totals[r] - mean;
+        sumSq += d * d;
+    }
+    return std::sqrt(sumSq / (n - 1));
+}
@@ -0,0 +1,408 @@
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GET_CUTS_X86 1
+#include <immintrin.h>
+#endif
+
+#include "CpuDispatch.h"
+#include "get_cuts.h"
+
+// The vector clause kernels gather fields straight out of the CutClause array
+static_assert(sizeof(size_t) == 8 && sizeof(CutClause) == 24 && offsetof(CutClause, min) == 8 &&
+              offsetof(CutClause, max) == 16, "Unexpected CutClause layout");
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Kernels with a single portable body are compiled once per level by wrapping them in functions with the level's
+// target attribute, so the compiler can use that level's instructions.
+
+static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static ALWAYS_INLINE bool isDigit(char c) {
+    return unsigned(c - '0') < 10;
+}
+
+// Decimal values whose significant digits fit in 53 bits and whose exponent is at most 22 are computed exactly by a
+// single multiplication or division of two exactly representable doubles (Clinger's fast path), which rounds the same
+// way strtod does. Anything else (more digits, hex, inf, nan) is left to strtod.
+static ALWAYS_INLINE const char* parseDoubleGeneric(const char* p, double* out) {
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int significantDigits = 0;
+    int exponent = 0;
+    size_t numDigits = 0;
+    auto addDigit = [&](char c) {
+        if (significantDigits >= 19) {
+            return false;
+        }
+        mantissa = mantissa * 10 + (c - '0');
+        significantDigits += mantissa != 0;
+        numDigits++;
+        return true;
+    };
+    for (; isDigit(*p); p++) {
+        if (!addDigit(*p)) {
+            return nullptr;
+        }
+    }
+    if (*p == '.') {
+        for (p++; isDigit(*p); p++) {
+            if (!addDigit(*p)) {
+                return nullptr;
+            }
+            exponent--;
+        }
+    }
+    if (numDigits == 0 || *p == 'x' || *p == 'X') {
+        return nullptr;
+    }
+    if (*p == 'e' || *p == 'E') {
+        const char* q = p + 1;
+        bool negativeExponent = *q == '-';
+        if (*q == '-' || *q == '+') {
+            q++;
+        }
+        if (!isDigit(*q)) {
+            return nullptr;
+        }
+        int e = 0;
+        for (; isDigit(*q); q++) {
+            e = e * 10 + (*q - '0');
+            if (e > 1000) {
+                return nullptr;
+            }
+        }
+        exponent += negativeExponent ? -e : e;
+        p = q;
+    }
+    if (mantissa > (uint64_t(1) << 53) || exponent < -22 || exponent > 22) {
+        return nullptr;
+    }
+
+    double value = double(mantissa);
+    value = exponent < 0 ? value / POW10[-exponent] : value * POW10[exponent];
+    *out = negative ? -value : value;
+    return p;
+}
+
+// Out-of-range variables throw from CutClause::matches(), so vector kernels defer to this when they find one
+static bool clausesMatchScalar(const CutClause* clauses, size_t numClauses, const Jet& jet) {
+    for (size_t i = 0; i < numClauses; i++) {
+        if (!clauses[i].matches(jet)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static ALWAYS_INLINE bool clausesMatchBranchless(const CutClause* clauses, size_t numClauses, const Jet& jet) {
+    for (size_t i = 0; i < numClauses; i++) {
+        if (clauses[i].varIndex >= jet.size()) {
+            return clausesMatchScalar(clauses, numClauses, jet);
+        }
+    }
+    bool match = true;
+    for (size_t i = 0; i < numClauses; i++) {
+        double val = jet[clauses[i].varIndex];
+        match &= (clauses[i].min <= val) & (val <= clauses[i].max);
+    }
+    return match;
+}
+
+static const char* findNewlineScalar(const char* p, const char* end) {
+    const void* found = std::memchr(p, '\n', end - p);
+    return found ? static_cast<const char*>(found) : end;
+}
+
+static const char* parseDoubleScalar(const char* p, double* out) {
+    return parseDoubleGeneric(p, out);
+}
+
+static size_t upperBoundScalar(const double* values, size_t n, double x) {
+    return std::upper_bound(values, values + n, x) - values;
+}
+
+// Counting the values <= x with vector compares beats a binary search for short arrays
+static const size_t MAX_LINEAR_UPPER_BOUND = 64;
+
+#ifdef GET_CUTS_X86
+
+#define SSE42_TARGET __attribute__((target("sse4.2,popcnt")))
+#define AVX2_TARGET __attribute__((target("avx2,popcnt")))
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw,popcnt")))
+
+SSE42_TARGET static const char* findNewlineSSE42(const char* p, const char* end) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        if (int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline))) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    while (p < end && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+SSE42_TARGET static const char* parseDoubleSSE42(const char* p, double* out) {
+    return parseDoubleGeneric(p, out);
+}
+
+SSE42_TARGET static bool clausesMatchSSE42(const CutClause* clauses, size_t numClauses, const Jet& jet) {
+    return clausesMatchBranchless(clauses, numClauses, jet);
+}
+
+SSE42_TARGET static size_t upperBoundSSE42(const double* values, size_t n, double x) {
+    if (n > MAX_LINEAR_UPPER_BOUND) {
+        return upperBoundScalar(values, n, x);
+    }
+    const __m128d xs = _mm_set1_pd(x);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        count += __builtin_popcount(_mm_movemask_pd(_mm_cmple_pd(_mm_loadu_pd(values + i), xs)));
+    }
+    for (; i < n; i++) {
+        count += values[i] <= x;
+    }
+    return count;
+}
+
+AVX2_TARGET static const char* findNewlineAVX2(const char* p, const char* end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        if (uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline))) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    while (p < end && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+AVX2_TARGET static const char* parseDoubleAVX2(const char* p, double* out) {
+    return parseDoubleGeneric(p, out);
+}
+
+// Four clauses at a time: gather each clause's variable index and range, then the jet's values at those indices
+AVX2_TARGET static bool clausesMatchAVX2(const CutClause* clauses, size_t numClauses, const Jet& jet) {
+    const __m256i fieldOffsets = _mm256_setr_epi64x(0, 3, 6, 9);  // in words; a CutClause is 3 words
+    const __m256i lanes = _mm256_setr_epi64x(0, 1, 2, 3);
+    const __m256i size = _mm256_set1_epi64x(jet.size());
+    for (size_t i = 0; i < numClauses; i += 4) {
+        __m256i active = _mm256_cmpgt_epi64(_mm256_set1_epi64x(numClauses - i), lanes);
+        const auto* base = reinterpret_cast<const long long*>(clauses + i);
+        __m256i vars = _mm256_mask_i64gather_epi64(_mm256_setzero_si256(), base, fieldOffsets, active, 8);
+        if (!_mm256_testc_si256(_mm256_cmpgt_epi64(size, vars), active)) {
+            return clausesMatchScalar(clauses + i, numClauses - i, jet);
+        }
+        __m256d activePd = _mm256_castsi256_pd(active);
+        __m256d mins = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), reinterpret_cast<const double*>(base) + 1,
+                                                fieldOffsets, activePd, 8);
+        __m256d maxes = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), reinterpret_cast<const double*>(base) + 2,
+                                                 fieldOffsets, activePd, 8);
+        __m256d values = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), jet.data(), vars, activePd, 8);
+        __m256d inRange = _mm256_and_pd(_mm256_cmp_pd(mins, values, _CMP_LE_OQ),
+                                        _mm256_cmp_pd(values, maxes, _CMP_LE_OQ));
+        if (_mm256_movemask_pd(inRange) != 0xF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+AVX2_TARGET static size_t upperBoundAVX2(const double* values, size_t n, double x) {
+    if (n > MAX_LINEAR_UPPER_BOUND) {
+        return upperBoundScalar(values, n, x);
+    }
+    const __m256d xs = _mm256_set1_pd(x);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(values + i), xs, _CMP_LE_OQ)));
+    }
+    for (; i < n; i++) {
+        count += values[i] <= x;
+    }
+    return count;
+}
+
+AVX512_TARGET static const char* findNewlineAVX512(const char* p, const char* end) {
+    const __m512i newline = _mm512_set1_epi8('\n');
+    while (p < end) {
+        size_t remaining = end - p;
+        __mmask64 active = remaining >= 64 ? ~__mmask64(0) : (__mmask64(1) << remaining) - 1;
+        __m512i bytes = _mm512_maskz_loadu_epi8(active, p);
+        if (__mmask64 mask = _mm512_mask_cmpeq_epi8_mask(active, bytes, newline)) {
+            return p + __builtin_ctzll(mask);
+        }
+        p += std::min<size_t>(remaining, 64);
+    }
+    return end;
+}
+
+AVX512_TARGET static const char* parseDoubleAVX512(const char* p, double* out) {
+    return parseDoubleGeneric(p, out);
+}
+
+// Eight clauses at a time, as clausesMatchAVX2()
+AVX512_TARGET static bool clausesMatchAVX512(const CutClause* clauses, size_t numClauses, const Jet& jet) {
+    const __m512i fieldOffsets = _mm512_setr_epi64(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m512i size = _mm512_set1_epi64(jet.size());
+    for (size_t i = 0; i < numClauses; i += 8) {
+        __mmask8 active = numClauses - i >= 8 ? 0xFF : (1 << (numClauses - i)) - 1;
+        const auto* base = reinterpret_cast<const long long*>(clauses + i);
+        __m512i vars = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), active, fieldOffsets, base, 8);
+        if (_mm512_mask_cmpgt_epi64_mask(active, size, vars) != active) {
+            return clausesMatchScalar(clauses + i, numClauses - i, jet);
+        }
+        __m512d mins = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), active, fieldOffsets,
+                                                reinterpret_cast<const double*>(base) + 1, 8);
+        __m512d maxes = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), active, fieldOffsets,
+                                                 reinterpret_cast<const double*>(base) + 2, 8);
+        __m512d values = _mm512_mask_i64gather_pd(_mm512_setzero_pd(), active, vars, jet.data(), 8);
+        __mmask8 inRange = _mm512_mask_cmp_pd_mask(_mm512_mask_cmp_pd_mask(active, mins, values, _CMP_LE_OQ), values,
+                                                   maxes, _CMP_LE_OQ);
+        if (inRange != active) {
+            return false;
+        }
+    }
+    return true;
+}
+
+AVX512_TARGET static size_t upperBoundAVX512(const double* values, size_t n, double x) {
+    if (n > MAX_LINEAR_UPPER_BOUND) {
+        return upperBoundScalar(values, n, x);
+    }
+    const __m512d xs = _mm512_set1_pd(x);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 8) {
+        __mmask8 active = n - i >= 8 ? 0xFF : (1 << (n - i)) - 1;
+        __m512d chunk = _mm512_maskz_loadu_pd(active, values + i);
+        count += __builtin_popcount(_mm512_mask_cmp_pd_mask(active, chunk, xs, _CMP_LE_OQ));
+    }
+    return count;
+}
+
+#endif  // GET_CUTS_X86
+
+static const CpuKernels KERNELS[] = {
+    {CpuLevel::Scalar, findNewlineScalar, parseDoubleScalar, clausesMatchScalar, upperBoundScalar},
+#ifdef GET_CUTS_X86
+    {CpuLevel::SSE42, findNewlineSSE42, parseDoubleSSE42, clausesMatchSSE42, upperBoundSSE42},
+    {CpuLevel::AVX2, findNewlineAVX2, parseDoubleAVX2, clausesMatchAVX2, upperBoundAVX2},
+    {CpuLevel::AVX512, findNewlineAVX512, parseDoubleAVX512, clausesMatchAVX512, upperBoundAVX512},
+#endif
+};
+
+// What each kernel actually runs at each level, for cpuFeatureReport(). Number parsing is the same portable code at
+// every level, and the histogram fill around the bin lookup has no vector variant.
+static const struct {
+    const char* kernel;
+    const char* variants[4];  // indexed by CpuLevel
+} KERNEL_VARIANTS[] = {
+    {"newline scan", {"scalar (memchr)", "sse4.2", "avx2", "avx512"}},
+    {"number parsing", {"scalar", "scalar", "scalar", "scalar"}},
+    {"clause evaluation", {"scalar", "scalar (branchless)", "avx2 gather", "avx512 gather"}},
+    {"bin lookup", {"scalar (binary search)", "sse4.2 up to 64 bins", "avx2 up to 64 bins", "avx512 up to 64 bins"}},
+    {"histogram fill", {"scalar", "scalar", "scalar", "scalar"}},
+};
+
+static const CpuLevel ALL_LEVELS[] = {CpuLevel::Scalar, CpuLevel::SSE42, CpuLevel::AVX2, CpuLevel::AVX512};
+
+const char* cpuLevelName(CpuLevel level) {
+    switch (level) {
+        case CpuLevel::Scalar: return "scalar";
+        case CpuLevel::SSE42: return "sse4.2";
+        case CpuLevel::AVX2: return "avx2";
+        case CpuLevel::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+CpuLevel detectCpuLevel() {
+#ifdef GET_CUTS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return CpuLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return CpuLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return CpuLevel::SSE42;
+    }
+#endif
+    return CpuLevel::Scalar;
+}
+
+const CpuKernels& cpuKernelsFor(CpuLevel level) {
+    if (level > detectCpuLevel()) {
+        throw std::runtime_error(std::string("This CPU does not support ") + cpuLevelName(level));
+    }
+    return KERNELS[size_t(level)];
+}
+
+static const char* forcedLevelName() {
+    const char* name = std::getenv("GET_CUTS_CPU");
+    return name && *name ? name : nullptr;
+}
+
+static const CpuKernels& selectKernels() {
+    const char* forced = forcedLevelName();
+    if (!forced) {
+        return cpuKernelsFor(detectCpuLevel());
+    }
+    for (auto level : ALL_LEVELS) {
+        if (std::strcmp(forced, cpuLevelName(level)) == 0) {
+            return cpuKernelsFor(level);
+        }
+    }
+    throw std::invalid_argument(std::string("Unknown GET_CUTS_CPU variant ") + forced +
+                                " (expected scalar, sse4.2, avx2, or avx512)");
+}
+
+const CpuKernels& cpuKernels() {
+    static const CpuKernels& kernels = selectKernels();
+    return kernels;
+}
+
+std::string cpuFeatureReport() {
+    std::string report = "supported:";
+    for (auto level : ALL_LEVELS) {
+        if (level <= detectCpuLevel()) {
+            report += std::string(" ") + cpuLevelName(level);
+        }
+    }
+    CpuLevel selected = cpuKernels().level;
+    report += std::string("\nselected: ") + cpuLevelName(selected) +
+              (forcedLevelName() ? " (forced by GET_CUTS_CPU)" : "") + "\n";
+    for (const auto& kernel : KERNEL_VARIANTS) {
+        report += std::string("  ") + kernel.kernel + ": " + kernel.variants[size_t(selected)] + "\n";
+    }
+    return report;
+}
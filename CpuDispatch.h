@@ -0,0 +1,48 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <cstddef>
+#include <string>
+
+#include "Jet.h"
+
+struct CutClause;
+
+// Hot kernels, each built for several x86 instruction set levels. The best level supported by the CPU is selected at
+// startup, unless the GET_CUTS_CPU environment variable names a different one (scalar, sse4.2, avx2, or avx512).
+// Every variant gives the same results as the scalar one.
+enum class CpuLevel { Scalar, SSE42, AVX2, AVX512 };
+
+struct CpuKernels {
+    CpuLevel level;
+
+    // First '\n' in [p, end), or end if there is none
+    const char* (*findNewline)(const char* p, const char* end);
+
+    // Parse the floating-point value at p (after optional spaces or tabs) in the common cases where it can be
+    // computed exactly without strtod. Returns the end of the value, or nullptr if strtod must be used instead.
+    const char* (*parseDouble)(const char* p, double* out);
+
+    // True if the jet satisfies all of the clauses, as CutClause::matches()
+    bool (*clausesMatch)(const CutClause* clauses, size_t numClauses, const Jet& jet);
+
+    // Number of the sorted `values` which are <= x, as std::upper_bound(). x must not be NaN.
+    size_t (*upperBound)(const double* values, size_t n, double x);
+};
+
+const char* cpuLevelName(CpuLevel level);
+
+// Best level supported by this CPU
+CpuLevel detectCpuLevel();
+
+// Kernels for a specific level, which must be supported by this CPU
+const CpuKernels& cpuKernelsFor(CpuLevel level);
+
+// Kernels selected at startup
+const CpuKernels& cpuKernels();
+
+// Supported and selected variants, for --cpu-features
+std::string cpuFeatureReport();
@@ -0,0 +1,36 @@
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include "CutJetsSession.h"
+
+CutJetsSession::CutJetsSession(const Format& format, const GetCutJetsSpec& spec)
+    : _format(format)
+    , _processor(format, spec)
+{
+    _jet.reserve(format.numVars() + spec.defines.size());
+}
+
+void CutJetsSession::pushEvent(const Event& event, const double* jets) {
+    if (!_processor.beginEvent(_numEvents++, event.weight, event.crossSection)) {
+        return;
+    }
+    _processor.setGluonFlags(event.isGluon1, event.isGluon2);
+    _processor.setZData(event.zData);
+    size_t numValues = numJetValues();
+    for (size_t j = 0; j < event.numJets; j++) {
+        if (!_processor.wantJet()) {
+            continue;
+        }
+        const double* values = jets + j * numValues;
+        _jet.assign(values, values + numValues);
+        _processor.addJet(_jet);
+    }
+}
+
+void CutJetsSession::pushEvents(const Event* events, size_t numEvents, const double* jets) {
+    for (size_t i = 0; i < numEvents; i++) {
+        pushEvent(events[i], jets);
+        jets += events[i].numJets * numJetValues();
+    }
+}
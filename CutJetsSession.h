@@ -0,0 +1,50 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <cmath>
+
+#include "get_cuts.h"
+
+// The cut and histogram engine for programs that produce events themselves, such as an event generator: events are
+// pushed in directly rather than being written out as text for getCutJets to parse. The session keeps no pointers to
+// what is pushed; each push copies the values it needs before returning. Like CutJetsProcessor, it refers to the
+// Format and spec, which must outlive it.
+class CutJetsSession {
+public:
+    // Event-level data. Gluon flags of 2 and Z data of INFINITY mean the event didn't have them, as in an input file.
+    struct Event {
+        double weight;
+        double crossSection;
+        int isGluon1 = 2;
+        int isGluon2 = 2;
+        double zData[5] = {INFINITY, INFINITY, INFINITY, INFINITY, INFINITY};
+        size_t numJets = 0;
+    };
+
+    CutJetsSession(const Format& format, const GetCutJetsSpec& spec);
+
+    // Number of values in each jet: the Format's variables other than the event-level ones, in the same order
+    size_t numJetValues() const {
+        return _format.numJetValues();
+    }
+
+    // Push an event and its `event.numJets` jets, which are stored one after another in `jets`, in input file order
+    void pushEvent(const Event& event, const double* jets);
+
+    // Push `numEvents` events, with all of their jets one after another in `jets`
+    void pushEvents(const Event* events, size_t numEvents, const double* jets);
+
+    // Normalize the histograms and return the result. The session should not be used afterward.
+    CutJetsResult finish() {
+        return _processor.finish();
+    }
+
+private:
+    const Format& _format;
+    CutJetsProcessor _processor;
+    uint64_t _numEvents = 0;  // pushed so far, which gives each event's position for bootstrap replicas
+    Jet _jet;  // reused for each jet (see CutJetsProcessor::addJet), so pushing doesn't allocate
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <array>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "get_cuts.h"
+
+// An input file held in memory, with jets stored column by column so that repeated queries don't need to re-read or
+// re-parse the text.
+struct EventStore {
+    const size_t numJetValues;  // values per jet line, i.e. the Format without the inserted event data
+    uint64_t firstEventIndex = 0;  // position of the first event in the input
+
+    std::vector<double> weights;
+    std::vector<double> crossSections;
+    std::vector<int> isGluon1;
+    std::vector<int> isGluon2;
+    std::vector<std::array<double, 5>> zData;
+    std::vector<size_t> jetOffsets{0};  // jets of event i are [jetOffsets[i], jetOffsets[i + 1])
+    std::vector<std::vector<double>> jetColumns;  // jetColumns[value][jet]
+
+    EventStore(const Format& format)
+        : numJetValues(format.numJetValues())
+        , jetColumns(numJetValues)
+    {}
+
+    size_t numEvents() const {
+        return weights.size();
+    }
+
+    size_t numJets() const {
+        return jetOffsets.back();
+    }
+
+    // Remove all events, keeping the memory for reuse
+    void clear() {
+        weights.clear();
+        crossSections.clear();
+        isGluon1.clear();
+        isGluon2.clear();
+        zData.clear();
+        jetOffsets.assign(1, 0);
+        for (auto& column : jetColumns) {
+            column.clear();
+        }
+    }
+
+    // Feed all events to `processor` exactly as if they were being read from the original file.
+    void replay(CutJetsProcessor& processor) const {
+        Jet jet;  // reused for every jet; the processor leaves an lvalue's storage with us
+        for (size_t i = 0; i < numEvents(); i++) {
+            processor.beginEvent(firstEventIndex + i, weights[i], crossSections[i]);
+            processor.setGluonFlags(isGluon1[i], isGluon2[i]);
+            double z[5];
+            std::copy(zData[i].begin(), zData[i].end(), std::begin(z));
+            processor.setZData(z);
+            for (size_t j = jetOffsets[i]; j < jetOffsets[i + 1]; j++) {
+                if (!processor.wantJet()) {
+                    continue;
+                }
+                jet.resize(numJetValues);
+                for (size_t v = 0; v < numJetValues; v++) {
+                    jet[v] = jetColumns[v][j];
+                }
+                processor.addJet(jet);
+            }
+        }
+    }
+
+    // Interface used by the file reader while loading
+
+    bool beginEvent(uint64_t eventIndex, double weight, double crossSection) {
+        if (weights.empty()) {
+            firstEventIndex = eventIndex;
+        }
+        weights.push_back(weight);
+        crossSections.push_back(crossSection);
+        isGluon1.push_back(2);
+        isGluon2.push_back(2);
+        zData.push_back({INFINITY, INFINITY, INFINITY, INFINITY, INFINITY});
+        jetOffsets.push_back(jetOffsets.back());
+        return true;
+    }
+
+    void setGluonFlags(int gluon1, int gluon2) {
+        isGluon1.back() = gluon1;
+        isGluon2.back() = gluon2;
+    }
+
+    void setZData(const double (&z)[5]) {
+        std::copy(std::begin(z), std::end(z), zData.back().begin());
+    }
+
+    bool wantJet() {
+        return true;
+    }
+
+    void addJet(Jet&& jet) {
+        if (jet.size() != numJetValues) {
+            throw std::length_error(
+                std::string("Expected jet to have ") + std::to_string(numJetValues + 8) +
+                " values, but encountered " + std::to_string(jet.size() + 8));
+        }
+        for (size_t v = 0; v < numJetValues; v++) {
+            jetColumns[v].push_back(jet[v]);
+        }
+        ++jetOffsets.back();
+    }
+};
+
+// Read and parse every event in the file into memory.
+EventStore loadEvents(const Format& format, const char* filename);
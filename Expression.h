@@ -0,0 +1,304 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// An arithmetic expression over jet variables, compiled to a small stack-machine program so it can be evaluated for
+// every jet without re-parsing. Supports + - * / ^, unary minus, parentheses, numbers, `pi`, and common math
+// functions (see FUNCTIONS below).
+class Expression {
+    enum class Op : uint8_t { Const, Var, Add, Sub, Mul, Div, Pow, Neg, Call1, Call2 };
+
+    struct Instruction {
+        Op op;
+        uint32_t arg;  // constant, variable, or function index
+    };
+
+    struct Function {
+        const char* name;
+        size_t arity;
+        double (*fn1)(double);
+        double (*fn2)(double, double);
+    };
+
+    // Absolute azimuthal separation, wrapped into [0, pi]
+    static double dphi(double a, double b) {
+        double d = std::fmod(std::abs(a - b), 2 * M_PI);
+        return d > M_PI ? 2 * M_PI - d : d;
+    }
+
+    static inline const Function FUNCTIONS[] = {
+        {"sqrt", 1, [](double x) { return std::sqrt(x); }, nullptr},
+        {"abs", 1, [](double x) { return std::abs(x); }, nullptr},
+        {"exp", 1, [](double x) { return std::exp(x); }, nullptr},
+        {"log", 1, [](double x) { return std::log(x); }, nullptr},
+        {"log10", 1, [](double x) { return std::log10(x); }, nullptr},
+        {"sin", 1, [](double x) { return std::sin(x); }, nullptr},
+        {"cos", 1, [](double x) { return std::cos(x); }, nullptr},
+        {"tan", 1, [](double x) { return std::tan(x); }, nullptr},
+        {"asin", 1, [](double x) { return std::asin(x); }, nullptr},
+        {"acos", 1, [](double x) { return std::acos(x); }, nullptr},
+        {"atan", 1, [](double x) { return std::atan(x); }, nullptr},
+        {"sinh", 1, [](double x) { return std::sinh(x); }, nullptr},
+        {"cosh", 1, [](double x) { return std::cosh(x); }, nullptr},
+        {"tanh", 1, [](double x) { return std::tanh(x); }, nullptr},
+        {"floor", 1, [](double x) { return std::floor(x); }, nullptr},
+        {"ceil", 1, [](double x) { return std::ceil(x); }, nullptr},
+        {"atan2", 2, nullptr, [](double y, double x) { return std::atan2(y, x); }},
+        {"pow", 2, nullptr, [](double x, double y) { return std::pow(x, y); }},
+        {"hypot", 2, nullptr, [](double x, double y) { return std::hypot(x, y); }},
+        {"min", 2, nullptr, [](double x, double y) { return std::min(x, y); }},
+        {"max", 2, nullptr, [](double x, double y) { return std::max(x, y); }},
+        {"dphi", 2, nullptr, dphi},
+    };
+
+    static const size_t MAX_STACK = 32;
+
+    std::vector<Instruction> _code;
+    std::vector<double> _constants;
+    std::vector<size_t> _inputs;  // variable indices read, without duplicates
+
+    // Recursive-descent compiler; emits instructions in evaluation (postfix) order
+    class Compiler {
+        Expression& _expr;
+        const std::string& _text;
+        const std::function<size_t(const std::string&)>& _lookup;
+        size_t _pos = 0;
+        size_t _depth = 0;
+        size_t _maxDepth = 0;
+
+        void error(const std::string& message) {
+            throw std::runtime_error(message + " at position " + std::to_string(_pos) + " of expression '" + _text + "'");
+        }
+
+        void skipSpace() {
+            while (_pos < _text.size() && std::isspace(static_cast<unsigned char>(_text[_pos]))) {
+                _pos++;
+            }
+        }
+
+        bool consume(char c) {
+            skipSpace();
+            if (_pos < _text.size() && _text[_pos] == c) {
+                _pos++;
+                return true;
+            }
+            return false;
+        }
+
+        void emit(Op op, uint32_t arg, int stackEffect) {
+            _expr._code.push_back({op, arg});
+            _depth += stackEffect;
+            _maxDepth = std::max(_maxDepth, _depth);
+        }
+
+        void expression() {
+            term();
+            while (true) {
+                if (consume('+')) {
+                    term();
+                    emit(Op::Add, 0, -1);
+                } else if (consume('-')) {
+                    term();
+                    emit(Op::Sub, 0, -1);
+                } else {
+                    return;
+                }
+            }
+        }
+
+        void term() {
+            unary();
+            while (true) {
+                if (consume('*')) {
+                    unary();
+                    emit(Op::Mul, 0, -1);
+                } else if (consume('/')) {
+                    unary();
+                    emit(Op::Div, 0, -1);
+                } else {
+                    return;
+                }
+            }
+        }
+
+        void unary() {
+            if (consume('-')) {
+                unary();
+                emit(Op::Neg, 0, 0);
+            } else if (consume('+')) {
+                unary();
+            } else {
+                power();
+            }
+        }
+
+        void power() {
+            primary();
+            if (consume('^')) {
+                unary();  // right-associative, and binds tighter than a unary minus on its left
+                emit(Op::Pow, 0, -1);
+            }
+        }
+
+        void primary() {
+            skipSpace();
+            if (_pos >= _text.size()) {
+                error("Expected value");
+            }
+            if (consume('(')) {
+                expression();
+                if (!consume(')')) {
+                    error("Expected ')'");
+                }
+                return;
+            }
+
+            char c = _text[_pos];
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                char* end = nullptr;
+                double value = std::strtod(_text.c_str() + _pos, &end);
+                if (end == _text.c_str() + _pos) {
+                    error("Expected number");
+                }
+                _pos = end - _text.c_str();
+                _expr._constants.push_back(value);
+                emit(Op::Const, uint32_t(_expr._constants.size() - 1), 1);
+                return;
+            }
+
+            if (!std::isalpha(static_cast<unsigned char>(c)) && c != '_') {
+                error(std::string("Unexpected '") + c + "'");
+            }
+            size_t start = _pos;
+            while (_pos < _text.size() && (std::isalnum(static_cast<unsigned char>(_text[_pos])) || _text[_pos] == '_')) {
+                _pos++;
+            }
+            std::string name = _text.substr(start, _pos - start);
+
+            if (consume('(')) {
+                size_t fnIndex = 0;
+                while (fnIndex < std::size(FUNCTIONS) && name != FUNCTIONS[fnIndex].name) {
+                    fnIndex++;
+                }
+                if (fnIndex == std::size(FUNCTIONS)) {
+                    error("Unknown function " + name);
+                }
+                const auto& fn = FUNCTIONS[fnIndex];
+                for (size_t i = 0; i < fn.arity; i++) {
+                    if (i > 0 && !consume(',')) {
+                        error(name + " expects " + std::to_string(fn.arity) + " arguments");
+                    }
+                    expression();
+                }
+                if (!consume(')')) {
+                    error("Expected ')'");
+                }
+                emit(fn.arity == 1 ? Op::Call1 : Op::Call2, uint32_t(fnIndex), 1 - int(fn.arity));
+            } else if (name == "pi") {
+                _expr._constants.push_back(M_PI);
+                emit(Op::Const, uint32_t(_expr._constants.size() - 1), 1);
+            } else {
+                size_t varIndex = _lookup(name);
+                if (std::find(_expr._inputs.begin(), _expr._inputs.end(), varIndex) == _expr._inputs.end()) {
+                    _expr._inputs.push_back(varIndex);
+                }
+                emit(Op::Var, uint32_t(varIndex), 1);
+            }
+        }
+
+    public:
+        Compiler(Expression& expr, const std::string& text, const std::function<size_t(const std::string&)>& lookup)
+            : _expr(expr), _text(text), _lookup(lookup) {}
+
+        void compile() {
+            expression();
+            skipSpace();
+            if (_pos != _text.size()) {
+                error("Unexpected '" + _text.substr(_pos, 1) + "'");
+            }
+            if (_maxDepth > MAX_STACK) {
+                error("Expression is too deeply nested");
+            }
+        }
+    };
+
+public:
+    // Compile `text`, using `lookup` to resolve variable names to indices (it should throw for unknown names).
+    Expression(const std::string& text, const std::function<size_t(const std::string&)>& lookup) {
+        Compiler(*this, text, lookup).compile();
+    }
+
+    // Indices of the variables the expression reads
+    const std::vector<size_t>& inputs() const {
+        return _inputs;
+    }
+
+    double evaluate(const double* vars) const {
+        double stack[MAX_STACK];
+        size_t top = 0;  // number of values on the stack
+        for (const auto& ins : _code) {
+            switch (ins.op) {
+                case Op::Const: stack[top++] = _constants[ins.arg]; break;
+                case Op::Var: stack[top++] = vars[ins.arg]; break;
+                case Op::Add: --top; stack[top - 1] += stack[top]; break;
+                case Op::Sub: --top; stack[top - 1] -= stack[top]; break;
+                case Op::Mul: --top; stack[top - 1] *= stack[top]; break;
+                case Op::Div: --top; stack[top - 1] /= stack[top]; break;
+                case Op::Pow: --top; stack[top - 1] = std::pow(stack[top - 1], stack[top]); break;
+                case Op::Neg: stack[top - 1] = -stack[top - 1]; break;
+                case Op::Call1: stack[top - 1] = FUNCTIONS[ins.arg].fn1(stack[top - 1]); break;
+                case Op::Call2: --top; stack[top - 1] = FUNCTIONS[ins.arg].fn2(stack[top - 1], stack[top]); break;
+            }
+        }
+        return stack[0];
+    }
+
+    // Fully parenthesized text of the expression, using `name` to print variable indices
+    std::string toString(const std::function<std::string(size_t)>& name) const {
+        std::vector<std::string> stack;
+        auto binary = [&](const char* op) {
+            std::string rhs = std::move(stack.back());
+            stack.pop_back();
+            stack.back() = "(" + stack.back() + " " + op + " " + rhs + ")";
+        };
+        for (const auto& ins : _code) {
+            switch (ins.op) {
+                case Op::Const: {
+                    char buf[32];
+                    std::snprintf(buf, sizeof(buf), "%.17g", _constants[ins.arg]);
+                    stack.push_back(buf);
+                    break;
+                }
+                case Op::Var: stack.push_back(name(ins.arg)); break;
+                case Op::Add: binary("+"); break;
+                case Op::Sub: binary("-"); break;
+                case Op::Mul: binary("*"); break;
+                case Op::Div: binary("/"); break;
+                case Op::Pow: binary("^"); break;
+                case Op::Neg: stack.back() = "(-" + stack.back() + ")"; break;
+                case Op::Call1: stack.back() = std::string(FUNCTIONS[ins.arg].name) + "(" + stack.back() + ")"; break;
+                case Op::Call2: {
+                    std::string rhs = std::move(stack.back());
+                    stack.pop_back();
+                    stack.back() = std::string(FUNCTIONS[ins.arg].name) + "(" + stack.back() + ", " + rhs + ")";
+                    break;
+                }
+            }
+        }
+        return stack.back();
+    }
+};
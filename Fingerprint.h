@@ -0,0 +1,47 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+inline uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 0xcbf29ce484222325) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ uint8_t(data[i])) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Size, modification time, and a hash of evenly spaced samples of the contents (including the start and end), as
+// "size mtime hash". Used to tell whether files derived from an input (cache entries, zone maps) are still valid.
+inline std::string inputFingerprint(const char* filename) {
+    static const size_t SAMPLE_BYTES = 4096;
+    static const size_t NUM_SAMPLES = 16;
+
+    uintmax_t size = std::filesystem::file_size(filename);
+    auto mtime = std::filesystem::last_write_time(filename).time_since_epoch().count();
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::system_error(errno, std::system_category(), std::string("Error opening ") + filename);
+    }
+    uint64_t hash = fnv1a(nullptr, 0);
+    std::vector<char> sample(SAMPLE_BYTES);
+    for (size_t i = 0; i < NUM_SAMPLES; i++) {
+        uintmax_t offset = size <= SAMPLE_BYTES ? 0 : (size - SAMPLE_BYTES) * i / (NUM_SAMPLES - 1);
+        in.seekg(offset);
+        in.read(sample.data(), sample.size());
+        hash = fnv1a(sample.data(), in.gcount(), hash);
+        in.clear();
+    }
+    std::ostringstream out;
+    out << size << ' ' << mtime << ' ' << std::hex << hash;
+    return out.str();
+}
@@ -4,26 +4,47 @@
 #error "This file requires C++17"
 #endif
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
-#include <string>
+#include <istream>
 #include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
+#include "Bootstrap.h"
 #include "Jet.h"
+#include "Serialization.h"
+#include "TDigest.h"
 
 struct IntHistogram {
     const std::string varName;
     const size_t varIndex;
-    double totalWeight;
-    double totalErr;
+    double totalWeight = 0;
+    double totalErr = 0;
     std::map<intmax_t, double> binSums;
     std::map<intmax_t, double> binErrs;
 
+    // Bootstrap replicas (see Bootstrap.h)
+    size_t numReplicas = 0;
+    std::vector<double> replicaTotals;
+    std::map<intmax_t, std::vector<double>> replicaSums;
+    std::map<intmax_t, double> binReplicaErrs;  // filled in by finish()
+
     IntHistogram(const std::string& varName, size_t varIndex)
         : varName(varName)
         , varIndex(varIndex) {}
 
-    void add(double weight, const Jet& jet) {
+    void setReplicas(size_t n) {
+        numReplicas = n;
+        replicaTotals.assign(n, 0);
+        replicaSums.clear();
+    }
+
+    // `replicaWeights` holds the event's weight in each bootstrap replica, if there are any
+    void add(double weight, const Jet& jet, const double* replicaWeights = nullptr) {
         double val = jet[varIndex];
         if (std::fmod(val, 1.0) != 0) {
             throw std::runtime_error("Used integer binning, but encountered non-integer " + std::to_string(val));
@@ -33,6 +54,100 @@ struct IntHistogram {
         binErrs[key] += weight * weight;
         totalWeight += weight;
         totalErr += weight * weight;
+
+        if (numReplicas > 0) {
+            auto& sums = replicaSums[key];
+            sums.resize(numReplicas, 0);
+            for (size_t r = 0; r < numReplicas; r++) {
+                double w = weight * replicaWeights[r];
+                sums[r] += w;
+                replicaTotals[r] += w;
+            }
+        }
+    }
+
+    void merge(const IntHistogram& other) {
+        totalWeight += other.totalWeight;
+        totalErr += other.totalErr;
+        for (const auto& [k, v] : other.binSums) {
+            binSums[k] += v;
+            binErrs[k] += other.binErrs.at(k);
+        }
+        for (const auto& [k, sums] : other.replicaSums) {
+            auto& mergedSums = replicaSums[k];
+            mergedSums.resize(numReplicas, 0);
+            for (size_t r = 0; r < numReplicas; r++) {
+                mergedSums[r] += sums[r];
+            }
+        }
+        for (size_t r = 0; r < numReplicas; r++) {
+            replicaTotals[r] += other.replicaTotals[r];
+        }
+    }
+
+    // Multiply the un-normalized accumulators as if every weight had been multiplied by `factor`
+    void scale(double factor) {
+        totalWeight *= factor;
+        totalErr *= factor * factor;
+        for (auto& [k, v] : binSums) {
+            v *= factor;
+            binErrs[k] *= factor * factor;
+        }
+        for (auto& [k, sums] : replicaSums) {
+            for (double& sum : sums) {
+                sum *= factor;
+            }
+        }
+        for (double& total : replicaTotals) {
+            total *= factor;
+        }
+    }
+
+    // Save or restore the un-normalized accumulators (before finish() is called)
+    void save(std::ostream& out) const {
+        writeExact(out, totalWeight);
+        out << ' ';
+        writeExact(out, totalErr);
+        out << ' ' << binSums.size();
+        for (const auto& [k, v] : binSums) {
+            out << ' ' << k << ' ';
+            writeExact(out, v);
+            out << ' ';
+            writeExact(out, binErrs.at(k));
+            if (numReplicas > 0) {
+                for (double sum : replicaSums.at(k)) {
+                    out << ' ';
+                    writeExact(out, sum);
+                }
+            }
+        }
+        for (double total : replicaTotals) {
+            out << ' ';
+            writeExact(out, total);
+        }
+        out << '\n';
+    }
+    void load(std::istream& in) {
+        totalWeight = readExact(in);
+        totalErr = readExact(in);
+        binSums.clear();
+        binErrs.clear();
+        replicaSums.clear();
+        for (auto n = readInteger(in); n > 0; n--) {
+            intmax_t key = readInteger(in);
+            binSums[key] = readExact(in);
+            binErrs[key] = readExact(in);
+            if (numReplicas > 0) {
+                auto& sums = replicaSums[key];
+                sums.resize(numReplicas);
+                for (auto& sum : sums) {
+                    sum = readExact(in);
+                }
+            }
+        }
+        for (auto& total : replicaTotals) {
+            total = readExact(in);
+        }
     }
 
     void finish() {
@@ -42,6 +157,9 @@ struct IntHistogram {
         for (auto& [k, v] : binErrs) {
             v = std::sqrt(v) / totalWeight;
         }
+        for (const auto& [k, sums] : replicaSums) {
+            binReplicaErrs[k] = replicaSpread(sums.data(), replicaTotals, 1);
+        }
     }
 };
 
@@ -54,6 +172,12 @@ struct BinHistogram {
     std::vector<double> binSums;
     std::vector<double> binErrs;
 
+    // Bootstrap replicas (see Bootstrap.h)
+    size_t numReplicas = 0;
+    std::vector<double> replicaTotals;
+    std::vector<double> replicaSums;  // bin-major, so one fill updates a contiguous run: [bin * numReplicas + replica]
+    std::vector<double> binReplicaErrs;  // filled in by finish()
+
     BinHistogram(const std::string& varName, size_t varIndex, std::vector<double>&& binEndpoints)
         : varName(varName)
         , varIndex(varIndex)
@@ -83,25 +207,108 @@ struct BinHistogram {
         binErrs.resize(nBins, 0);
     }
 
-    void add(double weight, const Jet& jet) {
+    void setReplicas(size_t n) {
+        numReplicas = n;
+        replicaTotals.assign(n, 0);
+        replicaSums.assign(binSums.size() * n, 0);
+    }
+
+    // `replicaWeights` holds the event's weight in each bootstrap replica, if there are any
+    void add(double weight, const Jet& jet, const double* replicaWeights = nullptr) {
         double val = jet[varIndex];
         auto iter = std::upper_bound(binEndpoints.begin(), binEndpoints.end(), val);
         size_t binIdx = iter - binEndpoints.begin();
+        size_t bin;
         if (binIdx == 0) {
             // value is less than all bins
+            return;
         } else if (binIdx <= binSums.size()) {
-            binSums[binIdx - 1] += weight;
-            binErrs[binIdx - 1] += weight * weight;
-            totalWeight += weight;
-            totalErr += weight * weight;
+            bin = binIdx - 1;
         } else if (val == binEndpoints.back()) {
             // value falls in last bin (inclusive)
-            binSums.back() += weight;
-            binErrs.back() += weight * weight;
-            totalWeight += weight;
-            totalErr += weight * weight;
+            bin = binSums.size() - 1;
         } else {
             // value is greater than all bins
+            return;
+        }
+
+        binSums[bin] += weight;
+        binErrs[bin] += weight * weight;
+        totalWeight += weight;
+        totalErr += weight * weight;
+
+        double* sums = replicaSums.data() + bin * numReplicas;
+        for (size_t r = 0; r < numReplicas; r++) {
+            double w = weight * replicaWeights[r];
+            sums[r] += w;
+            replicaTotals[r] += w;
+        }
+    }
+
+    void merge(const BinHistogram& other) {
+        totalWeight += other.totalWeight;
+        totalErr += other.totalErr;
+        for (size_t i = 0; i < binSums.size(); i++) {
+            binSums[i] += other.binSums[i];
+            binErrs[i] += other.binErrs[i];
+        }
+        for (size_t i = 0; i < replicaSums.size(); i++) {
+            replicaSums[i] += other.replicaSums[i];
+        }
+        for (size_t r = 0; r < numReplicas; r++) {
+            replicaTotals[r] += other.replicaTotals[r];
+        }
+    }
+
+    // Multiply the un-normalized accumulators as if every weight had been multiplied by `factor`
+    void scale(double factor) {
+        totalWeight *= factor;
+        totalErr *= factor * factor;
+        for (size_t i = 0; i < binSums.size(); i++) {
+            binSums[i] *= factor;
+            binErrs[i] *= factor * factor;
+        }
+        for (auto* values : {&replicaTotals, &replicaSums}) {
+            for (double& value : *values) {
+                value *= factor;
+            }
+        }
+    }
+
+    // Save or restore the un-normalized accumulators (before finish() is called)
+    void save(std::ostream& out) const {
+        writeExact(out, totalWeight);
+        out << ' ';
+        writeExact(out, totalErr);
+        out << ' ' << binSums.size();
+        for (size_t i = 0; i < binSums.size(); i++) {
+            out << ' ';
+            writeExact(out, binSums[i]);
+            out << ' ';
+            writeExact(out, binErrs[i]);
+        }
+        for (const auto* values : {&replicaTotals, &replicaSums}) {
+            for (double value : *values) {
+                out << ' ';
+                writeExact(out, value);
+            }
+        }
+        out << '\n';
+    }
+    void load(std::istream& in) {
+        totalWeight = readExact(in);
+        totalErr = readExact(in);
+        if (size_t(readInteger(in)) != binSums.size()) {
+            throw std::runtime_error("Saved histogram for " + varName + " has the wrong number of bins");
+        }
+        for (size_t i = 0; i < binSums.size(); i++) {
+            binSums[i] = readExact(in);
+            binErrs[i] = readExact(in);
+        }
+        for (auto* values : {&replicaTotals, &replicaSums}) {
+            for (double& value : *values) {
+                value = readExact(in);
+            }
         }
     }
 
@@ -111,5 +318,125 @@ struct BinHistogram {
             binSums[i] = binSums[i] / binWidth / totalWeight;
             binErrs[i] = std::sqrt(binErrs[i]) / binWidth / totalWeight;
         }
+        if (numReplicas > 0) {
+            binReplicaErrs.resize(binSums.size());
+            for (size_t i = 0; i < binSums.size(); i++) {
+                double binWidth = binEndpoints[i + 1] - binEndpoints[i];
+                binReplicaErrs[i] = replicaSpread(&replicaSums[i * numReplicas], replicaTotals, binWidth);
+            }
+        }
+    }
+};
+
+// Histogram whose bin endpoints are chosen from the data, so that each of the N bins holds an equal share of the
+// weight. The distribution is summarized in bounded memory during the pass and binned in finish().
+struct QuantileHistogram {
+    const std::string varName;
+    const size_t varIndex;
+    const size_t numBins;
+    double totalWeight = 0;
+    double totalErr = 0;
+    // A digest only holds positive weights, so negative weights (e.g. from NLO samples) go into a second digest by
+    // magnitude, and are subtracted from each bin
+    TDigest digest;
+    TDigest negativeDigest;
+
+    // Filled in by finish(); fewer than numBins bins if the variable has repeated values at bin endpoints
+    std::vector<double> binEndpoints;
+    std::vector<double> binSums;
+    std::vector<double> binErrs;
+
+    QuantileHistogram(const std::string& varName, size_t varIndex, size_t numBins)
+        : varName(varName)
+        , varIndex(varIndex)
+        , numBins(numBins)
+    {
+        if (numBins == 0) {
+            throw std::invalid_argument("Histogram must have at least 1 bin");
+        }
+    }
+
+    void add(double weight, const Jet& jet) {
+        double val = jet[varIndex];
+        if (!std::isfinite(val)) {
+            // e.g. Z data for events without muons; like values outside a BinHistogram, these aren't counted
+            return;
+        }
+        if (weight > 0) {
+            digest.add(val, weight);
+        } else if (weight < 0) {
+            negativeDigest.add(val, -weight);
+        }
+        totalWeight += weight;
+        totalErr += weight * weight;
+    }
+
+    void merge(const QuantileHistogram& other) {
+        digest.merge(other.digest);
+        negativeDigest.merge(other.negativeDigest);
+        totalWeight += other.totalWeight;
+        totalErr += other.totalErr;
+    }
+
+    // Multiply the un-normalized accumulators as if every weight had been multiplied by `factor`
+    void scale(double factor) {
+        digest.scale(factor);
+        negativeDigest.scale(factor);
+        totalWeight *= factor;
+        totalErr *= factor * factor;
+    }
+
+    // Save or restore the un-normalized accumulators (before finish() is called)
+    void save(std::ostream& out) const {
+        writeExact(out, totalWeight);
+        out << ' ';
+        writeExact(out, totalErr);
+        out << ' ';
+        digest.save(out);
+        negativeDigest.save(out);
+    }
+    void load(std::istream& in) {
+        totalWeight = readExact(in);
+        totalErr = readExact(in);
+        digest.load(in);
+        negativeDigest.load(in);
+    }
+
+    void finish() {
+        binEndpoints.clear();
+        binSums.clear();
+        binErrs.clear();
+        if (digest.totalWeight() == 0 && negativeDigest.totalWeight() == 0) {
+            return;
+        }
+        // Bins hold equal amounts of the values' total absolute weight
+        TDigest absolute = digest;
+        if (negativeDigest.totalWeight() > 0) {
+            absolute.merge(negativeDigest);
+        }
+        for (size_t i = 0; i <= numBins; i++) {
+            double endpoint = absolute.quantile(double(i) / numBins);
+            if (binEndpoints.empty() || endpoint > binEndpoints.back()) {
+                binEndpoints.push_back(endpoint);
+            }
+        }
+        if (binEndpoints.size() < 2) {
+            // all values were equal, so report a single zero-width bin holding all the weight
+            binEndpoints.push_back(binEndpoints.front());
+            binSums.push_back(1);
+            binErrs.push_back(std::sqrt(totalErr) / totalWeight);
+            return;
+        }
+        for (size_t i = 0; i + 1 < binEndpoints.size(); i++) {
+            double binWidth = binEndpoints[i + 1] - binEndpoints[i];
+            double lo = binEndpoints[i];
+            double hi = binEndpoints[i + 1];
+            double weight = digest.weightBelow(hi) - digest.weightBelow(lo) -
+                            (negativeDigest.weightBelow(hi) - negativeDigest.weightBelow(lo));
+            double weightSq = digest.weightSqBelow(hi) - digest.weightSqBelow(lo) +
+                              negativeDigest.weightSqBelow(hi) - negativeDigest.weightSqBelow(lo);
+            binSums.push_back(weight / binWidth / totalWeight);
+            binErrs.push_back(std::sqrt(std::max(weightSq, 0.0)) / binWidth / totalWeight);
+        }
     }
 };
@@ -0,0 +1,148 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "CpuDispatch.h"
+#include "Histogram.h"
+#include "Jet.h"
+
+// Accumulators for all of a spec's BinHistograms in one contiguous block, filled in place of BinHistogram::add().
+// Each histogram's block holds its totals and then each bin's sum and sum of squares side by side, so a fill touches
+// one or two cache lines. Bin endpoints and other metadata are kept separately from the accumulators. Histograms are
+// added in groups (one per cut), and results are copied back into BinHistograms with store().
+class HistogramArena {
+    // Layout of a histogram's block, starting at `offset`:
+    //   totalWeight, totalErr, then (sum, sumSq) for each bin, then numReplicas totals, then replica sums bin-major
+    struct Slot {
+        size_t varIndex;
+        size_t offset;
+        size_t numBins;
+        size_t endpointsOffset;  // into _endpoints
+        bool uniform;  // bin endpoints are evenly spaced, so the bin can be computed rather than searched for
+        double min;
+        double max;
+        double binsPerUnit;
+    };
+
+    const CpuKernels* _kernels = &cpuKernels();
+    size_t _numReplicas = 0;
+    std::vector<Slot> _slots;
+    std::vector<size_t> _groupStarts{0};  // slots of group g are [_groupStarts[g], _groupStarts[g + 1])
+    std::vector<double> _endpoints;
+    std::vector<double> _data;
+
+    static constexpr size_t NO_BIN = SIZE_MAX;
+
+    // Same result as the binary search in BinHistogram::add(): bins are half-open except the last, which includes
+    // its upper endpoint
+    size_t findBin(const Slot& slot, double val) const {
+        if (!(slot.min <= val && val <= slot.max)) {
+            return NO_BIN;
+        }
+        const double* endpoints = &_endpoints[slot.endpointsOffset];
+        if (slot.uniform) {
+            // The estimate can be off by one due to rounding, so check it against the endpoints
+            size_t bin = std::min(size_t((val - slot.min) * slot.binsPerUnit), slot.numBins - 1);
+            if (val < endpoints[bin]) {
+                bin--;
+            } else if (bin + 1 < slot.numBins && val >= endpoints[bin + 1]) {
+                bin++;
+            }
+            return bin;
+        }
+        size_t bin = _kernels->upperBound(endpoints, slot.numBins + 1, val);
+        return std::min(bin, slot.numBins) - 1;
+    }
+
+    size_t blockSize(size_t numBins) const {
+        return 2 + 2 * numBins + _numReplicas * (1 + numBins);
+    }
+
+public:
+    // Reserve accumulators for a group of histograms; returns the group index
+    size_t addGroup(const std::vector<BinHistogram>& hists) {
+        for (const auto& hist : hists) {
+            _numReplicas = hist.numReplicas;
+            size_t numBins = hist.binSums.size();
+            double min = hist.binEndpoints.front();
+            double max = hist.binEndpoints.back();
+            bool uniform = true;
+            for (size_t i = 0; i <= numBins; i++) {
+                uniform &= hist.binEndpoints[i] == min + (max - min) * i / numBins;
+            }
+            _slots.push_back({hist.varIndex, _data.size(), numBins, _endpoints.size(), uniform, min, max, numBins / (max - min)});
+            _endpoints.insert(_endpoints.end(), hist.binEndpoints.begin(), hist.binEndpoints.end());
+            _data.resize(_data.size() + blockSize(numBins), 0);
+        }
+        _groupStarts.push_back(_slots.size());
+        return _groupStarts.size() - 2;
+    }
+
+    // Add a jet to every histogram in the group. `replicaWeights` holds the event's weight in each bootstrap replica.
+    void fill(size_t group, double weight, const Jet& jet, const double* replicaWeights) {
+        for (size_t s = _groupStarts[group]; s < _groupStarts[group + 1]; s++) {
+            const Slot& slot = _slots[s];
+            size_t bin = findBin(slot, jet[slot.varIndex]);
+            if (bin == NO_BIN) {
+                continue;
+            }
+            double* block = &_data[slot.offset];
+            block[0] += weight;
+            block[1] += weight * weight;
+            block[2 + 2 * bin] += weight;
+            block[3 + 2 * bin] += weight * weight;
+
+            if (_numReplicas > 0) {
+                double* replicaTotals = block + 2 + 2 * slot.numBins;
+                double* replicaSums = replicaTotals + _numReplicas + bin * _numReplicas;
+                for (size_t r = 0; r < _numReplicas; r++) {
+                    double w = weight * replicaWeights[r];
+                    replicaSums[r] += w;
+                    replicaTotals[r] += w;
+                }
+            }
+        }
+    }
+
+    // Copy the group's accumulators into `hists` (which must be the histograms the group was created from), or
+    // restore them from `hists`
+    void store(size_t group, std::vector<BinHistogram>& hists) const {
+        for (size_t s = _groupStarts[group]; s < _groupStarts[group + 1]; s++) {
+            const Slot& slot = _slots[s];
+            auto& hist = hists[s - _groupStarts[group]];
+            const double* block = &_data[slot.offset];
+            hist.totalWeight = block[0];
+            hist.totalErr = block[1];
+            for (size_t bin = 0; bin < slot.numBins; bin++) {
+                hist.binSums[bin] = block[2 + 2 * bin];
+                hist.binErrs[bin] = block[3 + 2 * bin];
+            }
+            const double* replicas = block + 2 + 2 * slot.numBins;
+            std::copy(replicas, replicas + _numReplicas, hist.replicaTotals.begin());
+            std::copy(replicas + _numReplicas, replicas + _numReplicas * (1 + slot.numBins), hist.replicaSums.begin());
+        }
+    }
+    void load(size_t group, const std::vector<BinHistogram>& hists) {
+        for (size_t s = _groupStarts[group]; s < _groupStarts[group + 1]; s++) {
+            const Slot& slot = _slots[s];
+            const auto& hist = hists[s - _groupStarts[group]];
+            double* block = &_data[slot.offset];
+            block[0] = hist.totalWeight;
+            block[1] = hist.totalErr;
+            for (size_t bin = 0; bin < slot.numBins; bin++) {
+                block[2 + 2 * bin] = hist.binSums[bin];
+                block[3 + 2 * bin] = hist.binErrs[bin];
+            }
+            double* replicas = block + 2 + 2 * slot.numBins;
+            std::copy(hist.replicaTotals.begin(), hist.replicaTotals.end(), replicas);
+            std::copy(hist.replicaSums.begin(), hist.replicaSums.end(), replicas + _numReplicas);
+        }
+    }
+};
@@ -0,0 +1,182 @@
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "JetDump.h"
+#include "get_cuts.h"
+
+static const char MAGIC[8] = {'G', 'C', 'J', 'E', 'T', 'S', '1', '\0'};
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const uint32_t END_MARKER = 0xFFFFFFFF;
+
+// Jets are buffered per cut, up to MAX_BATCH_SIZE at a time but within BUFFER_BYTES in total
+static const size_t MAX_BATCH_SIZE = 4096;
+static const size_t MIN_BATCH_SIZE = 64;
+static const size_t BUFFER_BYTES = size_t(64) << 20;
+static const size_t FILE_BUFFER_BYTES = size_t(1) << 20;
+
+static size_t padTo8(size_t size) {
+    return (size + 7) / 8 * 8;
+}
+
+JetDumpWriter::JetDumpWriter(const std::string& path, const Format& format, size_t numCuts)
+    : _numVars(format.numVars())
+    , _batchSize(std::clamp(BUFFER_BYTES / std::max<size_t>(numCuts, 1) / ((_numVars + 2) * 8),
+                            MIN_BATCH_SIZE, MAX_BATCH_SIZE))
+    , _file(std::fopen(path.c_str(), "wb"), std::fclose)
+    , _path(path)
+    , _batches(numCuts)
+{
+    if (!_file) {
+        throw std::system_error(errno, std::system_category(), "Error opening " + path);
+    }
+    std::setvbuf(_file.get(), nullptr, _IOFBF, FILE_BUFFER_BYTES);
+
+    std::string names;
+    for (const auto& var : format.vars) {
+        names += var;
+        names += '\0';
+    }
+    names.resize(padTo8(names.size()), '\0');
+
+    uint32_t counts[] = {BYTE_ORDER_MARK, uint32_t(_numVars), uint32_t(numCuts), uint32_t(names.size())};
+    write(MAGIC, sizeof(MAGIC));
+    write(counts, sizeof(counts));
+    write(names.data(), names.size());
+
+    for (auto& batch : _batches) {
+        batch.weights.reserve(_batchSize);
+        batch.eventOrdinals.reserve(_batchSize);
+        batch.values.resize(_numVars * _batchSize);
+    }
+}
+
+void JetDumpWriter::write(const void* data, size_t size) {
+    if (std::fwrite(data, 1, size, _file.get()) != size) {
+        throw std::system_error(errno, std::system_category(), "Error writing " + _path);
+    }
+}
+
+void JetDumpWriter::flush(size_t cutIndex) {
+    auto& batch = _batches[cutIndex];
+    size_t numJets = batch.weights.size();
+    if (numJets == 0) {
+        return;
+    }
+    uint32_t header[] = {uint32_t(cutIndex), uint32_t(numJets)};
+    write(header, sizeof(header));
+    write(batch.weights.data(), numJets * sizeof(double));
+    write(batch.eventOrdinals.data(), numJets * sizeof(uint64_t));
+    for (size_t v = 0; v < _numVars; v++) {
+        write(&batch.values[v * _batchSize], numJets * sizeof(double));
+    }
+    batch.weights.clear();
+    batch.eventOrdinals.clear();
+}
+
+void JetDumpWriter::close() {
+    for (size_t i = 0; i < _batches.size(); i++) {
+        flush(i);
+    }
+    uint32_t end[] = {END_MARKER, 0};
+    write(end, sizeof(end));
+    if (std::fclose(_file.release()) != 0) {
+        throw std::system_error(errno, std::system_category(), "Error writing " + _path);
+    }
+}
+
+
+JetDumpReader::JetDumpReader(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(), "Error opening " + path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::system_category(), "Error reading " + path);
+    }
+    _size = st.st_size;
+    if (_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("Jet dump " + path + " is truncated");
+    }
+    void* data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw std::system_error(err, std::system_category(), "Error mapping " + path);
+    }
+    _data = static_cast<const char*>(data);
+
+    try {
+        size_t pos = 0;
+        auto take = [&](size_t size) {
+            if (size > _size - pos) {
+                throw std::runtime_error("Jet dump " + path + " is truncated");
+            }
+            const char* p = _data + pos;
+            pos += size;
+            return p;
+        };
+        auto takeU32 = [&] {
+            uint32_t val;
+            std::memcpy(&val, take(sizeof(val)), sizeof(val));
+            return val;
+        };
+
+        if (std::memcmp(take(sizeof(MAGIC)), MAGIC, sizeof(MAGIC)) != 0) {
+            throw std::runtime_error(path + " is not a jet dump");
+        }
+        if (takeU32() != BYTE_ORDER_MARK) {
+            throw std::runtime_error("Jet dump " + path + " was written with a different byte order");
+        }
+        size_t numVars = takeU32();
+        _numCuts = takeU32();
+        size_t namesSize = takeU32();
+        const char* names = take(namesSize);
+        for (size_t i = 0, start = 0; i < numVars; i++) {
+            size_t len = strnlen(names + start, namesSize - start);
+            if (start + len >= namesSize) {
+                throw std::runtime_error("Jet dump " + path + " has a corrupt header");
+            }
+            _vars.emplace_back(names + start, len);
+            start += len + 1;
+        }
+
+        while (true) {
+            uint32_t cutIndex = takeU32();
+            size_t numJets = takeU32();
+            if (cutIndex == END_MARKER) {
+                break;
+            }
+            if (cutIndex >= _numCuts) {
+                throw std::runtime_error("Jet dump " + path + " has a batch for unknown cut " + std::to_string(cutIndex));
+            }
+            Batch batch{cutIndex, numJets, nullptr, nullptr, nullptr};
+            batch.weights = reinterpret_cast<const double*>(take(numJets * sizeof(double)));
+            batch.eventOrdinals = reinterpret_cast<const uint64_t*>(take(numJets * sizeof(uint64_t)));
+            batch.values = reinterpret_cast<const double*>(take(numVars * numJets * sizeof(double)));
+            _batches.push_back(batch);
+        }
+    } catch (...) {
+        ::munmap(const_cast<char*>(_data), _size);
+        throw;
+    }
+}
+
+JetDumpReader::~JetDumpReader() {
+    ::munmap(const_cast<char*>(_data), _size);
+}
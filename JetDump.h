@@ -0,0 +1,105 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Jet.h"
+
+struct Format;
+
+// Binary columnar file of the jets accepted by each cut, written by `get_cuts --dump-jets`. Everything is in native
+// byte order and 8-byte aligned, so the file can be mmapped and its columns used in place:
+//
+//   header:  char magic[8] = "GCJETS1\0"
+//            uint32 byteOrder = 0x01020304, uint32 numVars, uint32 numCuts, uint32 namesSize
+//            char names[namesSize]  (each variable name followed by '\0', then zero padding to a multiple of 8)
+//   batches: uint32 cutIndex, uint32 numJets
+//            double weights[numJets], uint64 eventOrdinals[numJets], double values[numVars][numJets]
+//   end:     uint32 0xFFFFFFFF, uint32 0
+//
+// Event ordinals count events from the start of the input, including any dropped by sampling. Batches of different
+// cuts are interleaved, and each cut's batches are in input order.
+
+// Buffers each cut's jets and writes them out in batches
+class JetDumpWriter {
+    size_t _numVars;
+    size_t _batchSize;
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> _file;
+    std::string _path;
+
+    struct Batch {
+        std::vector<double> weights;
+        std::vector<uint64_t> eventOrdinals;
+        std::vector<double> values;  // values[var * batchSize + jet]
+    };
+    std::vector<Batch> _batches;
+
+    void write(const void* data, size_t size);
+    void flush(size_t cutIndex);
+
+public:
+    JetDumpWriter(const std::string& path, const Format& format, size_t numCuts);
+
+    // Record a jet accepted by a cut; only the Format's variables are written
+    void add(size_t cutIndex, uint64_t eventOrdinal, double weight, const Jet& jet) {
+        auto& batch = _batches[cutIndex];
+        size_t i = batch.weights.size();
+        batch.weights.push_back(weight);
+        batch.eventOrdinals.push_back(eventOrdinal);
+        for (size_t v = 0; v < _numVars; v++) {
+            batch.values[v * _batchSize + i] = jet[v];
+        }
+        if (i + 1 == _batchSize) {
+            flush(cutIndex);
+        }
+    }
+
+    // Write out the remaining jets and the end marker
+    void close();
+};
+
+// Maps a dump file into memory and indexes its batches
+class JetDumpReader {
+public:
+    struct Batch {
+        size_t cutIndex;
+        size_t numJets;
+        const double* weights;
+        const uint64_t* eventOrdinals;
+        const double* values;
+
+        const double* column(size_t var) const {
+            return values + var * numJets;
+        }
+    };
+
+private:
+    const char* _data = nullptr;
+    size_t _size = 0;
+    std::vector<std::string> _vars;
+    size_t _numCuts = 0;
+    std::vector<Batch> _batches;
+
+public:
+    explicit JetDumpReader(const std::string& path);
+    ~JetDumpReader();
+    JetDumpReader(const JetDumpReader&) = delete;
+    JetDumpReader& operator=(const JetDumpReader&) = delete;
+
+    const std::vector<std::string>& vars() const {
+        return _vars;
+    }
+    size_t numCuts() const {
+        return _numCuts;
+    }
+    const std::vector<Batch>& batches() const {
+        return _batches;
+    }
+};
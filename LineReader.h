@@ -4,15 +4,20 @@
 #error "This file requires C++17"
 #endif
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <limits>
 #include <memory>
 #include <system_error>
 #include <vector>
 
+#include "CpuDispatch.h"
 #include "Progress.h"
 
-size_t getFileSize(std::FILE* file) {
+inline size_t getFileSize(std::FILE* file) {
     if (file) {
         if (std::fseek(file, 0, SEEK_END) != 0) {
             throw std::system_error(errno, std::system_category(), "Error seeking to end");
@@ -23,16 +28,65 @@ size_t getFileSize(std::FILE* file) {
 }
 
 // Helper class to read a file line by line, and parse values out of the most recently read line.
+// The file is read in large blocks, and lines are found and parsed in place using the kernels from CpuDispatch.h.
 class LineReader {
+public:
+    // Reads up to `size` bytes into `buf` and returns how many were read, or 0 at the end of the input
+    using Source = std::function<size_t(char* buf, size_t size)>;
+
+private:
     static const size_t MAX_LINE_LENGTH = 1024;
+    static const size_t BLOCK_SIZE = size_t(1) << 20;
+
+    const CpuKernels& _kernels;
 
     char* _p = nullptr;  // current position in line
     char* _end = nullptr;  // end of line
 
-    char _buf[MAX_LINE_LENGTH];
+    size_t _lineOffset = 0;  // file offset of the current line
+    size_t _nextLineOffset = 0;  // file offset of the line after the current one
+
+    bool _growing = false;
+    bool _readAll = false;  // no more data can be read from the file into _buf
+    size_t _fileOffset = 0;  // file offset of the data that the next fill() reads
+    size_t _rangeEnd = std::numeric_limits<size_t>::max();  // file offset to stop reading at, set by setRange()
+
+    // Data read from the file but not yet returned as lines is [_bufPos, _bufEnd). The extra byte leaves room to
+    // terminate a last line which has no trailing newline.
+    std::unique_ptr<char[]> _buf{new char[BLOCK_SIZE + 1]};
+    size_t _bufPos = 0;
+    size_t _bufEnd = 0;
+    Source _source;  // read from instead of _file, if set
     std::unique_ptr<std::FILE, decltype(&std::fclose)> _file;
     Progress _progress; // must be after _file since we use _file during initialization
 
+    // Read from the file until the buffer is full or the file ends
+    void fill() {
+        while (_bufEnd < BLOCK_SIZE && !_readAll) {
+            size_t size = std::min(BLOCK_SIZE - _bufEnd, _rangeEnd - _fileOffset);
+            size_t n = _source ? _source(_buf.get() + _bufEnd, size)
+                               : std::fread(_buf.get() + _bufEnd, 1, size, _file.get());
+            _bufEnd += n;
+            _fileOffset += n;
+            if (n == 0) {
+                if (_file && std::ferror(_file.get())) {
+                    throw std::system_error(errno, std::system_category(), "Error reading from file");
+                }
+                _readAll = true;
+            }
+        }
+    }
+
+    bool finish() {
+        if (_rangeEnd == std::numeric_limits<size_t>::max()) {
+            _progress.finish();
+        }
+        _bufPos = _bufEnd;
+        _p = nullptr;
+        _end = nullptr;
+        return false;
+    }
+
     void checkEnd() {
         if (_p == _end) {
             throw std::out_of_range("Read past end of line");
@@ -40,48 +94,111 @@ class LineReader {
     }
 
 public:
-    LineReader(const char* filename)
-        : _file(std::fopen(filename, "r"), std::fclose)
-        , _progress(filename, getFileSize(_file.get()))
+    // Open `filename` for reading, optionally starting from a line that begins at `startOffset` bytes into the file.
+    LineReader(const char* filename, size_t startOffset = 0)
+        : _kernels(cpuKernels())
+        , _nextLineOffset(startOffset)
+        , _fileOffset(startOffset)
+        , _file(std::fopen(filename, "r"), std::fclose)
+        , _progress(filename, getFileSize(_file.get()) - startOffset)
     {
         if (!_file) {
             throw std::system_error(errno, std::system_category(), std::string("Error opening ") + filename);
         }
-        std::rewind(_file.get());
+        if (startOffset > getFileSize(_file.get())) {
+            throw std::out_of_range(std::string("Start offset is past the end of ") + filename);
+        }
+        if (std::fseek(_file.get(), startOffset, SEEK_SET) != 0) {
+            throw std::system_error(errno, std::system_category(), "Error seeking to start offset");
+        }
     }
 
+    // Read lines from `source` instead of a file. `name` and `totalBytes` are only used for the progress bar.
+    LineReader(const std::string& name, size_t totalBytes, Source source)
+        : _kernels(cpuKernels())
+        , _source(std::move(source))
+        , _file(nullptr, std::fclose)
+        , _progress(name, totalBytes)
+    {}
+
     // Load a new line from the file. Returns true if the operation succeeded, false if the end of the file was reached.
     bool nextLine() {
-        if (!std::fgets(_buf, MAX_LINE_LENGTH, _file.get())) {
-            if (atEOF()) {
-                _progress.finish();
-                _p = nullptr;
-                _end = nullptr;
-                return false;
-            }
-            throw std::system_error(errno, std::system_category(), "Error reading line from file");
+        char* start = _buf.get() + _bufPos;
+        char* newline = const_cast<char*>(_kernels.findNewline(start, _buf.get() + _bufEnd));
+        if (newline == _buf.get() + _bufEnd && !_readAll) {
+            // Move the partial line to the front of the buffer and read more after it
+            size_t partial = _bufEnd - _bufPos;
+            std::memmove(_buf.get(), start, partial);
+            _bufPos = 0;
+            _bufEnd = partial;
+            fill();
+            start = _buf.get();
+            newline = const_cast<char*>(_kernels.findNewline(start + partial, _buf.get() + _bufEnd));
         }
 
-        size_t len = std::strlen(_buf);
-        _progress.addBytesRead(len);
-
-        if (len == 0) {
-            _p = nullptr;
-            _end = nullptr;
-            return false;
+        size_t len = newline - start;
+        bool hasNewline = newline != _buf.get() + _bufEnd;
+        if (len == 0 && !hasNewline) {
+            return finish();
+        }
+        if (!hasNewline && _readAll && _growing) {
+            // the last line is still being written
+            return finish();
         }
-        if (_buf[len - 1] == '\n') {
-            _buf[len - 1] = 0;  // allows for later use of strcmp()
-            --len;
-        } else if (!atEOF()) {
+        if (len + 1 >= MAX_LINE_LENGTH) {
             throw std::length_error("Max line length exceeded");
         }
 
-        _p = _buf;
-        _end = _p + len;
+        size_t consumed = len + hasNewline;
+        _progress.addBytesRead(consumed);
+        _lineOffset = _nextLineOffset;
+        _nextLineOffset += consumed;
+        _bufPos += consumed;
+
+        *newline = 0;  // allows for later use of strcmp()
+        _p = start;
+        _end = newline;
         return true;
     }
 
+    // Continue from the line beginning at `start`, and stop at `end` as if the file ended there. Ranges must be set
+    // in increasing order; the bytes skipped in between count towards the progress bar.
+    void setRange(size_t start, size_t end) {
+        size_t fileSize = getFileSize(_file.get());
+        if (start < _nextLineOffset || end < start || end > fileSize) {
+            throw std::out_of_range("Invalid range to read");
+        }
+        if (std::fseek(_file.get(), start, SEEK_SET) != 0) {
+            throw std::system_error(errno, std::system_category(), "Error seeking to start of range");
+        }
+        _progress.addBytesRead(start - _nextLineOffset);
+        _nextLineOffset = _fileOffset = start;
+        _rangeEnd = end == fileSize ? std::numeric_limits<size_t>::max() : end;
+        _readAll = false;
+        _bufPos = _bufEnd = 0;
+        _p = _end = nullptr;
+    }
+
+    // Don't show a progress bar
+    void hideProgress() {
+        _progress.hide();
+    }
+
+    // Treat the file as still being written, so a last line without a trailing newline is ignored
+    void setGrowing() {
+        _growing = true;
+    }
+
+    // True if the file may still be being written, so its last event may be incomplete
+    bool isGrowing() const {
+        return _growing;
+    }
+
+    // Byte offset in the file of the start of the current line
+    size_t lineOffset() const {
+        return _lineOffset;
+    }
+
     // True if all characters on the current line have been consumed
     bool usedWholeLine() const {
         return _p == _end;
@@ -89,7 +206,7 @@ public:
 
     // True if the last call to `nextLine()` reached the end of the input file
     bool atEOF() const {
-        return std::feof(_file.get());
+        return _readAll && _bufPos == _bufEnd;
     }
 
     // Validate that `str` appears next in the line, and consume it
@@ -126,8 +243,13 @@ public:
 
     // Skip whitespace and consume the next floating-point value
     double readDouble() {
+        double val;
+        if (const char* end = _kernels.parseDouble(_p, &val)) {
+            _p = const_cast<char*>(end);
+            return val;
+        }
         char* end = _end;
-        double val = std::strtod(_p, &end);
+        val = std::strtod(_p, &end);
         if (end == _p) {
             throw std::runtime_error("Unable to read double");
         }
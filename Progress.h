@@ -17,6 +17,7 @@ class Progress {
     size_t _totalBytes = 0;
     size_t _bytesRead = 0;
     size_t _bytesReadAtLastReport = 0;
+    bool _hidden = false;
     Clock::time_point _startTime;
     Clock::time_point _lastReportTime;
 
@@ -25,7 +26,11 @@ class Progress {
     }
 
     void report() {
-        double percentRead = _bytesRead / double(_totalBytes);
+        if (_hidden) {
+            _bytesReadAtLastReport = _bytesRead;
+            return;
+        }
+        double percentRead = _totalBytes ? _bytesRead / double(_totalBytes) : 0;  // the size of a pipe isn't known
         int filledWidth = percentRead * PROGRESS_WIDTH;
 
         double rate = double(_bytesRead - _bytesReadAtLastReport) / 1024 / 1024 / secondsSince(_lastReportTime);
@@ -52,7 +57,15 @@ public:
         }
     }
 
+    // Don't print anything, e.g. when several readers work through one file at once
+    void hide() {
+        _hidden = true;
+    }
+
     void finish() {
+        if (_hidden) {
+            return;
+        }
         double totalElapsed = secondsSince(_startTime);
         std::fprintf(stderr, "\r\x1b[K%s [%s] Done in %2.1lfs (%2.1lf MB/s avg)\n",
             _name.c_str(), std::string(PROGRESS_WIDTH, '=').c_str(), totalElapsed, double(_bytesRead) / 1024 / 1024 / totalElapsed);
@@ -0,0 +1,291 @@
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include "Fingerprint.h"
+#include "ResultCache.h"
+
+// Canonical descriptions of what determines each piece of a result. Derived variables are replaced by their
+// expressions, so the names given to them don't matter, and clauses are sorted since their order doesn't either.
+struct CacheKeys {
+    const Format& format;
+    const GetCutJetsSpec& spec;
+
+    std::string var(size_t varIndex) const {
+        if (varIndex < format.numVars()) {
+            return format.vars[varIndex];
+        }
+        const auto& expression = spec.defines[varIndex - format.numVars()].expression;
+        return "(" + expression.toString([&](size_t i) { return var(i); }) + ")";
+    }
+
+    // Settings which affect the event totals and every cut
+    std::string events() const {
+        std::ostringstream out;
+        out.precision(17);
+        out << "vars";
+        for (const auto& var : format.vars) {
+            out << ' ' << var;
+        }
+        out << "\ntakeNum: " << spec.takeNum << "\nskipNum: " << spec.skipNum << "\nstrict: " << spec.strict;
+        out << "\neventProbabilityMultiplier: " << spec.eventProbabilityMultiplier;
+        out << "\nrandomSeed: " << spec.randomSeed << "\nbootstrapReplicas: " << spec.bootstrapReplicas << '\n';
+        return out.str();
+    }
+
+    std::string cut(const Cut& cut) const {
+        std::vector<std::string> clauses;
+        for (const auto& clause : cut.clauses) {
+            std::ostringstream out;
+            out.precision(17);
+            out << var(clause.varIndex) << ' ' << clause.min << ' ' << clause.max << '\n';
+            clauses.push_back(out.str());
+        }
+        std::sort(clauses.begin(), clauses.end());
+        std::string key = events() + "new_cut\n";
+        for (const auto& clause : clauses) {
+            key += clause;
+        }
+        return key;
+    }
+
+    std::string histogram(const Cut& c, const IntHistogram& hist) const {
+        return cut(c) + "histogram_ints: " + var(hist.varIndex) + '\n';
+    }
+    std::string histogram(const Cut& c, const BinHistogram& hist) const {
+        std::ostringstream out;
+        out.precision(17);
+        out << "histogram_custom: " << var(hist.varIndex);
+        for (double endpoint : hist.binEndpoints) {
+            out << ' ' << endpoint;
+        }
+        return cut(c) + out.str() + '\n';
+    }
+    std::string histogram(const Cut& c, const QuantileHistogram& hist) const {
+        return cut(c) + "histogram_quantiles: " + var(hist.varIndex) + ' ' + std::to_string(hist.numBins) + '\n';
+    }
+};
+
+template<typename T>
+static std::string saved(const T& value) {
+    std::ostringstream out;
+    value.save(out);
+    return out.str();
+}
+
+ResultCache::ResultCache(const std::string& dir, const char* inputFilename)
+    : _dir(dir)
+    , _inputKey("input " + inputFingerprint(inputFilename) + "\n")
+{
+    std::filesystem::create_directories(dir);
+}
+
+// Entries are files named by a hash of their key, holding the full key (to rule out collisions) and then the data
+std::string ResultCache::entryPath(const std::string& header, const char* kind) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.", (unsigned long long)fnv1a(header.data(), header.size()));
+    return _dir + "/" + name + kind;
+}
+
+std::string ResultCache::entryHeader(const std::string& key) const {
+    std::string fullKey = _inputKey + key;
+    return "get_cuts_cache 2\n" + std::to_string(fullKey.size()) + '\n' + fullKey;
+}
+
+std::optional<std::string> ResultCache::load(const std::string& key, const char* kind) const {
+    std::string header = entryHeader(key);
+    std::ifstream in(entryPath(header, kind), std::ios::binary);
+    if (!in) {
+        return std::nullopt;
+    }
+    std::string contents{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    if (contents.compare(0, header.size(), header) != 0) {
+        return std::nullopt;
+    }
+    return contents.substr(header.size());
+}
+
+void ResultCache::store(const std::string& key, const char* kind, const std::string& data) const {
+    std::string header = entryHeader(key);
+    std::string path = entryPath(header, kind);
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary);
+        out << header << data;
+        if (!out.flush()) {
+            throw std::system_error(errno, std::system_category(), "Error writing cache entry " + tmpPath);
+        }
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw std::system_error(errno, std::system_category(), "Error replacing cache entry " + path);
+    }
+}
+
+static const char* outputKind(OutputFormat outputFormat) {
+    switch (outputFormat) {
+        case OutputFormat::YAML: return "output";
+        case OutputFormat::JSON: return "output.json";
+        case OutputFormat::Binary: return "output.bin";
+    }
+    throw std::logic_error("Unknown output format");
+}
+
+std::optional<std::string> ResultCache::loadOutput(const Format& format, const GetCutJetsSpec& spec,
+                                                   OutputFormat outputFormat) const {
+    return load(CacheKeys{format, spec}.events() + spec.canonical(format), outputKind(outputFormat));
+}
+
+void ResultCache::storeOutput(const Format& format, const GetCutJetsSpec& spec, const std::string& output,
+                              OutputFormat outputFormat) const {
+    store(CacheKeys{format, spec}.events() + spec.canonical(format), outputKind(outputFormat), output);
+}
+
+CutJetsResult ResultCache::getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec) {
+    CacheKeys keys{format, spec};
+    _piecesReused = 0;
+    _piecesComputed = 0;
+
+    // Saved accumulators of each piece, or nullopt if it must be computed
+    struct CutPieces {
+        std::optional<std::string> totals;
+        std::vector<std::optional<std::string>> intHistograms;
+        std::vector<std::optional<std::string>> binHistograms;
+        std::vector<std::optional<std::string>> quantileHistograms;
+    };
+    std::optional<std::string> events = load(keys.events(), "events");
+    std::vector<CutPieces> cuts(spec.cuts.size());
+    std::map<size_t, CutResult> scanResults;  // cuts with a scan are always computed as a whole, and not stored
+
+    // Compute the missing pieces with a spec which has only the cuts and histograms that are missing
+    GetCutJetsSpec missing = spec;
+    missing.cuts.clear();
+    std::vector<size_t> cutsComputed;  // indices in `spec` of the cuts in `missing`
+    for (size_t i = 0; i < spec.cuts.size(); i++) {
+        const auto& cut = spec.cuts[i];
+        auto& pieces = cuts[i];
+        if (cut.scan) {
+            _piecesComputed++;
+            cutsComputed.push_back(i);
+            missing.cuts.push_back(cut);
+            continue;
+        }
+        Cut missingCut;
+        missingCut.clauses = cut.clauses;
+        missingCut.eventClauses = cut.eventClauses;
+        missingCut.jetClauses = cut.jetClauses;
+
+        pieces.totals = load(keys.cut(cut), "cut");
+        for (const auto& hist : cut.intHistograms) {
+            pieces.intHistograms.push_back(load(keys.histogram(cut, hist), "hist"));
+            if (!pieces.intHistograms.back()) missingCut.intHistograms.push_back(hist);
+        }
+        for (const auto& hist : cut.binHistograms) {
+            pieces.binHistograms.push_back(load(keys.histogram(cut, hist), "hist"));
+            if (!pieces.binHistograms.back()) missingCut.binHistograms.push_back(hist);
+        }
+        for (const auto& hist : cut.quantileHistograms) {
+            pieces.quantileHistograms.push_back(load(keys.histogram(cut, hist), "hist"));
+            if (!pieces.quantileHistograms.back()) missingCut.quantileHistograms.push_back(hist);
+        }
+
+        size_t numMissing = !pieces.totals + missingCut.intHistograms.size() + missingCut.binHistograms.size() +
+                            missingCut.quantileHistograms.size();
+        size_t numPieces = 1 + cut.intHistograms.size() + cut.binHistograms.size() + cut.quantileHistograms.size();
+        _piecesComputed += numMissing;
+        _piecesReused += numPieces - numMissing;
+        if (numMissing > 0) {
+            cutsComputed.push_back(i);
+            missing.cuts.push_back(std::move(missingCut));
+        }
+    }
+    (events ? _piecesReused : _piecesComputed)++;
+
+    if (!events || !missing.cuts.empty()) {
+        CutJetsProcessor processor(format, missing);
+        readEvents(format, filename, processor);
+        CutJetsResult computed = processor.finishAccumulators();
+
+        if (!events) {
+            std::ostringstream out;
+            out << computed.numEvents << ' ';
+            writeExact(out, computed.totalWeight);
+            out << ' ';
+            writeExact(out, computed.csOnW);
+            out << '\n';
+            events = out.str();
+            store(keys.events(), "events", *events);
+        }
+        for (size_t c = 0; c < cutsComputed.size(); c++) {
+            const auto& cut = spec.cuts[cutsComputed[c]];
+            auto& cutResult = computed.cutResults[c];
+            auto& pieces = cuts[cutsComputed[c]];
+            if (cut.scan) {
+                scanResults.emplace(cutsComputed[c], std::move(cutResult));
+                continue;
+            }
+            if (!pieces.totals) {
+                pieces.totals = std::to_string(cutResult.totalJetsTaken) + '\n';
+                store(keys.cut(cut), "cut", *pieces.totals);
+            }
+            auto storeMissing = [&](const auto& hists, auto& slots, const auto& computedHists) {
+                for (size_t h = 0, next = 0; h < hists.size(); h++) {
+                    if (!slots[h]) {
+                        slots[h] = saved(computedHists[next++]);
+                        store(keys.histogram(cut, hists[h]), "hist", *slots[h]);
+                    }
+                }
+            };
+            storeMissing(cut.intHistograms, pieces.intHistograms, cutResult.intHistograms);
+            storeMissing(cut.binHistograms, pieces.binHistograms, cutResult.binHistograms);
+            storeMissing(cut.quantileHistograms, pieces.quantileHistograms, cutResult.quantileHistograms);
+        }
+    }
+
+    // Assemble the result from the saved accumulators
+    CutJetsResult result;
+    {
+        std::istringstream in(*events);
+        result.numEvents = readInteger(in);
+        result.totalWeight = readExact(in);
+        result.csOnW = readExact(in);
+    }
+    for (size_t i = 0; i < spec.cuts.size(); i++) {
+        const auto& cut = spec.cuts[i];
+        const auto& pieces = cuts[i];
+        if (cut.scan) {
+            result.cutResults.push_back(std::move(scanResults.at(i)));
+            continue;
+        }
+        CutResult cutResult{
+            .intHistograms = cut.intHistograms,
+            .binHistograms = cut.binHistograms,
+            .quantileHistograms = cut.quantileHistograms,
+        };
+        cutResult.totalJetsTaken = std::stoull(*pieces.totals);
+        auto loadAll = [](auto& hists, const auto& slots) {
+            for (size_t h = 0; h < hists.size(); h++) {
+                std::istringstream in(*slots[h]);
+                hists[h].load(in);
+            }
+        };
+        loadAll(cutResult.intHistograms, pieces.intHistograms);
+        loadAll(cutResult.binHistograms, pieces.binHistograms);
+        loadAll(cutResult.quantileHistograms, pieces.quantileHistograms);
+        result.cutResults.push_back(std::move(cutResult));
+    }
+    result.finish();
+    return result;
+}
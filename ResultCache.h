@@ -0,0 +1,50 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <optional>
+#include <string>
+
+#include "get_cuts.h"
+#include "output.h"
+
+// On-disk cache of results, keyed by a fingerprint of the input file (its size, modification time, and a hash of
+// samples of its contents) and a canonical description of what was computed. Besides the complete output for a
+// spec, the un-normalized accumulators of each cut and histogram are stored separately, so a spec which shares cuts
+// or histograms with earlier ones only needs to compute the missing pieces (cuts with a scan are only stored as part of
+// the complete output). Entries are never removed; delete the directory to clear it.
+class ResultCache {
+    std::string _dir;
+    std::string _inputKey;
+    size_t _piecesReused = 0;
+    size_t _piecesComputed = 0;
+
+    std::string entryHeader(const std::string& key) const;
+    std::string entryPath(const std::string& header, const char* kind) const;
+    std::optional<std::string> load(const std::string& key, const char* kind) const;
+    void store(const std::string& key, const char* kind, const std::string& data) const;
+
+public:
+    // Open (or create) the cache in `dir` for queries on `inputFilename`
+    ResultCache(const std::string& dir, const char* inputFilename);
+
+    // The complete output in `outputFormat` previously stored for `spec`, if any
+    std::optional<std::string> loadOutput(const Format& format, const GetCutJetsSpec& spec,
+                                          OutputFormat outputFormat = OutputFormat::YAML) const;
+    void storeOutput(const Format& format, const GetCutJetsSpec& spec, const std::string& output,
+                     OutputFormat outputFormat = OutputFormat::YAML) const;
+
+    // Like getCutJets, but reuse the stored accumulators of any event totals, cuts, and histograms that are already
+    // in the cache, and store the rest
+    CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec);
+
+    // Number of pieces (event totals, cut totals, and histograms) reused or computed by the last getCutJets()
+    size_t piecesReused() const {
+        return _piecesReused;
+    }
+    size_t piecesComputed() const {
+        return _piecesComputed;
+    }
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+// Helpers for saving intermediate state as whitespace-separated text. Doubles are written in hexadecimal floating
+// point so they read back exactly.
+
+inline void writeExact(std::ostream& out, double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%a", value);
+    out << buf;
+}
+
+inline std::string readWord(std::istream& in, const std::string& description) {
+    std::string word;
+    if (!(in >> word)) {
+        throw std::runtime_error("Expected " + description + " in saved state");
+    }
+    return word;
+}
+
+inline double readExact(std::istream& in) {
+    std::string word = readWord(in, "number");
+    char* end = nullptr;
+    double value = std::strtod(word.c_str(), &end);
+    if (*end != 0) {
+        throw std::runtime_error("Expected number in saved state but found " + word);
+    }
+    return value;
+}
+
+inline long long readInteger(std::istream& in) {
+    std::string word = readWord(in, "integer");
+    char* end = nullptr;
+    long long value = std::strtoll(word.c_str(), &end, 10);
+    if (*end != 0) {
+        throw std::runtime_error("Expected integer in saved state but found " + word);
+    }
+    return value;
+}
+
+inline void expectWord(std::istream& in, const std::string& expected) {
+    std::string actual = readWord(in, "'" + expected + "'");
+    if (actual != expected) {
+        throw std::runtime_error("Expected '" + expected + "' in saved state but found " + actual);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free queue between one producer thread and one consumer thread. push() and pop() block while the ring
+// is full or empty (spinning briefly, then yielding, then sleeping), and add up how long each side waited so that
+// backpressure between pipeline stages can be reported. Both give up and return false once `cancelled` is set.
+template<typename T>
+class SpscRing {
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<T> _slots;
+    const size_t _mask;
+    const std::atomic<bool>& _cancelled;
+
+    // Positions only ever increase; slot i is _slots[i & _mask]. Each side keeps a cached copy of the other side's
+    // position so that it only touches the other's cache line when the ring looks full or empty.
+    alignas(64) std::atomic<size_t> _head{0};  // next position to pop, written by the consumer
+    size_t _cachedTail = 0;
+    alignas(64) std::atomic<size_t> _tail{0};  // next position to push, written by the producer
+    size_t _cachedHead = 0;
+
+    template<typename Ready>
+    bool waitUntil(Ready&& ready, double& waitSeconds) {
+        if (ready()) {
+            return true;
+        }
+        auto start = Clock::now();
+        for (size_t attempt = 0; !ready(); attempt++) {
+            if (_cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if (attempt > 1000) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            } else if (attempt > 50) {
+                std::this_thread::yield();
+            }
+        }
+        waitSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+        return true;
+    }
+
+public:
+    double pushWaitSeconds = 0;  // time the producer spent waiting for space
+    double popWaitSeconds = 0;  // time the consumer spent waiting for items
+
+    // `capacity` must be a power of two
+    SpscRing(size_t capacity, const std::atomic<bool>& cancelled)
+        : _slots(capacity)
+        , _mask(capacity - 1)
+        , _cancelled(cancelled)
+    {
+        if (capacity == 0 || (capacity & _mask) != 0) {
+            throw std::invalid_argument("Ring capacity must be a power of two");
+        }
+    }
+
+    bool push(T value) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        bool ready = waitUntil([&] {
+            if (tail - _cachedHead <= _mask) {
+                return true;
+            }
+            _cachedHead = _head.load(std::memory_order_acquire);
+            return tail - _cachedHead <= _mask;
+        }, pushWaitSeconds);
+        if (!ready) {
+            return false;
+        }
+        _slots[tail & _mask] = std::move(value);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        bool ready = waitUntil([&] {
+            if (head != _cachedTail) {
+                return true;
+            }
+            _cachedTail = _tail.load(std::memory_order_acquire);
+            return head != _cachedTail;
+        }, popWaitSeconds);
+        if (!ready) {
+            return false;
+        }
+        out = std::move(_slots[head & _mask]);
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "Serialization.h"
+
+// Streaming approximation of a weighted distribution in bounded memory (the "merging" t-digest of Dunning & Ertl).
+// Values are summarized by a sorted list of centroids which are kept small near the tails, so quantiles are accurate
+// over the whole range. Digests can be merged, so partial results from separate passes can be combined.
+class TDigest {
+public:
+    struct Centroid {
+        double mean;
+        double weight;
+        double weightSq;  // sum of squared weights, for error estimates
+
+        bool operator<(const Centroid& other) const {
+            return mean < other.mean;
+        }
+    };
+
+private:
+    static constexpr double COMPRESSION = 200;  // roughly the maximum number of centroids
+    static constexpr size_t BUFFER_SIZE = 5 * size_t(COMPRESSION);
+
+    std::vector<Centroid> _centroids;  // sorted by mean
+    std::vector<Centroid> _buffer;  // values not yet merged into _centroids
+    double _totalWeight = 0;
+    double _min = INFINITY;
+    double _max = -INFINITY;
+
+    // Scale function controlling centroid size at quantile q
+    static double k(double q) {
+        return COMPRESSION / (2 * M_PI) * std::asin(2 * q - 1);
+    }
+
+    void compress() {
+        if (_buffer.empty()) {
+            return;
+        }
+        _buffer.insert(_buffer.end(), _centroids.begin(), _centroids.end());
+        std::sort(_buffer.begin(), _buffer.end());
+        _centroids.clear();
+
+        double weightSoFar = 0;
+        Centroid current = _buffer.front();
+        double kLeft = k(0);
+        for (auto it = _buffer.begin() + 1; it != _buffer.end(); ++it) {
+            double proposed = current.weight + it->weight;
+            if (k((weightSoFar + proposed) / _totalWeight) - kLeft <= 1) {
+                current.mean += (it->mean - current.mean) * it->weight / proposed;
+                current.weight = proposed;
+                current.weightSq += it->weightSq;
+            } else {
+                weightSoFar += current.weight;
+                kLeft = k(weightSoFar / _totalWeight);
+                _centroids.push_back(current);
+                current = *it;
+            }
+        }
+        _centroids.push_back(current);
+        _buffer.clear();
+    }
+
+    // Cumulative sum of `field` over values below x, treating each centroid as spread evenly between the means of
+    // its neighbors (and the exact min/max at the ends).
+    template<typename Field>
+    double cumulativeBelow(double x, Field field) const {
+        if (_centroids.empty() || x < _min) {
+            return 0;
+        }
+        double total = 0;
+        for (const auto& c : _centroids) {
+            total += c.*field;
+        }
+        if (x >= _max) {
+            return total;
+        }
+
+        double left = _min;
+        double cumulative = 0;  // below `left`
+        for (size_t i = 0; i <= _centroids.size(); i++) {
+            double right = i < _centroids.size() ? _centroids[i].mean : _max;
+            double span = (i > 0 ? _centroids[i - 1].*field / 2 : 0) + (i < _centroids.size() ? _centroids[i].*field / 2 : 0);
+            if (x < right) {
+                return cumulative + (right > left ? span * (x - left) / (right - left) : 0);
+            }
+            cumulative += span;
+            left = right;
+        }
+        return total;
+    }
+
+public:
+    // Weights must be positive; others are ignored
+    void add(double value, double weight) {
+        if (weight <= 0) {
+            return;
+        }
+        _buffer.push_back({value, weight, weight * weight});
+        _totalWeight += weight;
+        _min = std::min(_min, value);
+        _max = std::max(_max, value);
+        if (_buffer.size() >= BUFFER_SIZE) {
+            compress();
+        }
+    }
+
+    void merge(const TDigest& other) {
+        for (const auto* list : {&other._centroids, &other._buffer}) {
+            for (const auto& c : *list) {
+                _buffer.push_back(c);
+                _totalWeight += c.weight;
+                if (_buffer.size() >= BUFFER_SIZE) {
+                    compress();
+                }
+            }
+        }
+        _min = std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+    }
+
+    // Multiply every weight added so far by `factor`, which must be positive
+    void scale(double factor) {
+        for (auto* list : {&_centroids, &_buffer}) {
+            for (auto& c : *list) {
+                c.weight *= factor;
+                c.weightSq *= factor * factor;
+            }
+        }
+        _totalWeight *= factor;
+    }
+
+    double totalWeight() const {
+        return _totalWeight;
+    }
+
+    // Value below which a fraction q of the total weight lies
+    double quantile(double q) {
+        compress();
+        if (_centroids.empty()) {
+            return NAN;
+        }
+        if (q <= 0) {
+            return _min;
+        }
+        if (q >= 1) {
+            return _max;
+        }
+        double target = q * _totalWeight;
+        double left = _min;
+        double cumulative = 0;
+        for (size_t i = 0; i <= _centroids.size(); i++) {
+            double right = i < _centroids.size() ? _centroids[i].mean : _max;
+            double span = (i > 0 ? _centroids[i - 1].weight / 2 : 0) + (i < _centroids.size() ? _centroids[i].weight / 2 : 0);
+            if (cumulative + span >= target) {
+                return span > 0 ? left + (right - left) * (target - cumulative) / span : left;
+            }
+            cumulative += span;
+            left = right;
+        }
+        return _max;
+    }
+
+    // Approximate total weight and sum of squared weights of the values below x
+    double weightBelow(double x) {
+        compress();
+        return cumulativeBelow(x, &Centroid::weight);
+    }
+    double weightSqBelow(double x) {
+        compress();
+        return cumulativeBelow(x, &Centroid::weightSq);
+    }
+
+    void save(std::ostream& out) const {
+        writeExact(out, _totalWeight);
+        out << ' ';
+        writeExact(out, _min);
+        out << ' ';
+        writeExact(out, _max);
+        for (const auto* list : {&_centroids, &_buffer}) {
+            out << ' ' << list->size();
+            for (const auto& c : *list) {
+                out << ' ';
+                writeExact(out, c.mean);
+                out << ' ';
+                writeExact(out, c.weight);
+                out << ' ';
+                writeExact(out, c.weightSq);
+            }
+        }
+        out << '\n';
+    }
+
+    void load(std::istream& in) {
+        _totalWeight = readExact(in);
+        _min = readExact(in);
+        _max = readExact(in);
+        for (auto* list : {&_centroids, &_buffer}) {
+            list->clear();
+            for (auto n = readInteger(in); n > 0; n--) {
+                double mean = readExact(in);
+                double weight = readExact(in);
+                double weightSq = readExact(in);
+                list->push_back({mean, weight, weightSq});
+            }
+        }
+    }
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Runs a fixed set of tasks on a pool of threads, each with its own deque of tasks. A thread works through its own
+// deque from the front, in the order the tasks were added, and once it's empty steals from the back of another
+// thread's deque; so a thread that was given one huge task doesn't leave the others idle once they finish theirs.
+// Tasks are only added before run(), so a thread can stop as soon as it finds every deque empty.
+template<typename Task>
+class WorkStealingPool {
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::atomic<size_t> _steals{0};
+
+    std::optional<Task> take(size_t thread) {
+        auto& own = *_workers[thread];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                Task task = std::move(own.tasks.front());
+                own.tasks.pop_front();
+                return task;
+            }
+        }
+        for (size_t i = 1; i < _workers.size(); i++) {
+            auto& victim = *_workers[(thread + i) % _workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                Task task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+                ++_steals;
+                return task;
+            }
+        }
+        return std::nullopt;
+    }
+
+public:
+    explicit WorkStealingPool(size_t numThreads) {
+        for (size_t i = 0; i < std::max<size_t>(numThreads, 1); i++) {
+            _workers.push_back(std::make_unique<Worker>());
+        }
+    }
+
+    size_t numThreads() const {
+        return _workers.size();
+    }
+
+    // Number of tasks run by a thread other than the one they were added for
+    size_t steals() const {
+        return _steals;
+    }
+
+    // Queue `task` to run on `thread`, unless another thread steals it
+    void add(size_t thread, Task task) {
+        _workers[thread % _workers.size()]->tasks.push_back(std::move(task));
+    }
+
+    // Call fn(task, thread) for every task, and return once all have finished. If any call throws, the tasks not yet
+    // started are dropped and the first exception is rethrown.
+    template<typename Fn>
+    void run(Fn&& fn) {
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        auto work = [&](size_t thread) {
+            try {
+                while (auto task = take(thread)) {
+                    fn(*task, thread);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                for (auto& worker : _workers) {
+                    std::lock_guard<std::mutex> workerLock(worker->mutex);
+                    worker->tasks.clear();
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < _workers.size(); i++) {
+            threads.emplace_back(work, i);
+        }
+        work(0);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
@@ -0,0 +1,98 @@
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <system_error>
+
+#include "ZoneMap.h"
+
+bool ZoneMap::mayMatch(const Block& block, const Cut& cut) const {
+    for (const auto& clause : cut.clauses) {
+        if (clause.varIndex < vars.size() &&
+            (block.max[clause.varIndex] < clause.min || block.min[clause.varIndex] > clause.max)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<bool> ZoneMap::blocksToRead(const GetCutJetsSpec& spec) const {
+    std::vector<bool> result;
+    for (const auto& block : blocks) {
+        result.push_back(std::any_of(spec.cuts.begin(), spec.cuts.end(),
+                                     [&](const Cut& cut) { return mayMatch(block, cut); }));
+    }
+    return result;
+}
+
+void ZoneMap::save(const std::string& path) const {
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath);
+        out << "get_cuts_zone_map 2\nvars " << vars.size();
+        for (const auto& var : vars) {
+            out << ' ' << var;
+        }
+        out << "\ninput_size " << inputSize << "\ninput_fingerprint " << inputFingerprint << "\nblocks " << blocks.size() << '\n';
+        for (const auto& block : blocks) {
+            out << block.startOffset << ' ' << block.endOffset << ' ' << block.eventsThrough << ' ';
+            writeExact(out, block.weightThrough);
+            out << ' ';
+            writeExact(out, block.crossSection);
+            for (size_t v = 0; v < vars.size(); v++) {
+                out << ' ';
+                writeExact(out, block.min[v]);
+                out << ' ';
+                writeExact(out, block.max[v]);
+            }
+            out << '\n';
+        }
+        if (!out.flush()) {
+            throw std::system_error(errno, std::system_category(), "Error writing zone map " + tmpPath);
+        }
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw std::system_error(errno, std::system_category(), "Error replacing zone map " + path);
+    }
+}
+
+ZoneMap ZoneMap::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::system_error(errno, std::system_category(), "Error opening " + path);
+    }
+    expectWord(in, "get_cuts_zone_map");
+    if (readInteger(in) != 2) {
+        throw std::runtime_error("Unsupported zone map version");
+    }
+
+    ZoneMap zoneMap;
+    expectWord(in, "vars");
+    for (auto n = readInteger(in); n > 0; n--) {
+        zoneMap.vars.push_back(readWord(in, "variable name"));
+    }
+    expectWord(in, "input_size");
+    zoneMap.inputSize = readInteger(in);
+    expectWord(in, "input_fingerprint");
+    for (int i = 0; i < 3; i++) {
+        zoneMap.inputFingerprint += (i > 0 ? " " : "") + readWord(in, "input fingerprint");
+    }
+    expectWord(in, "blocks");
+    for (auto n = readInteger(in); n > 0; n--) {
+        Block block;
+        block.startOffset = readInteger(in);
+        block.endOffset = readInteger(in);
+        block.eventsThrough = readInteger(in);
+        block.weightThrough = readExact(in);
+        block.crossSection = readExact(in);
+        for (size_t v = 0; v < zoneMap.vars.size(); v++) {
+            block.min.push_back(readExact(in));
+            block.max.push_back(readExact(in));
+        }
+        zoneMap.blocks.push_back(std::move(block));
+    }
+    return zoneMap;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "get_cuts.h"
+
+// Summary of an input file in blocks of consecutive events, written by `get_cuts input.txt --build-zone-map` and used
+// to skip the blocks in which no jet can pass any cut. Besides the range of each variable over the block's jets, each
+// block records the running event totals as of its end, so the totals come out exactly as if it had been read.
+struct ZoneMap {
+    static const size_t DEFAULT_EVENTS_PER_BLOCK = 1024;
+
+    struct Block {
+        size_t startOffset;  // of the block's first "New Event" line
+        size_t endOffset;  // of the next block, or the end of the file
+        size_t eventsThrough;  // number of events from the start of the input to the end of this block
+        double weightThrough;  // sum of those events' weights, added in input order
+        double crossSection;  // of the block's last event
+        std::vector<double> min;  // of each Format variable over the block's jets, ignoring NaNs
+        std::vector<double> max;
+    };
+
+    std::vector<std::string> vars;
+    size_t inputSize = 0;
+    std::string inputFingerprint;  // of the input it was built from (see Fingerprint.h), which it's only valid for
+    std::vector<Block> blocks;
+
+    // True if some jet in `block` may satisfy every clause of `cut`. Derived variables aren't summarized, so clauses
+    // on them never rule out a block.
+    bool mayMatch(const Block& block, const Cut& cut) const;
+
+    // Whether each block has to be read to evaluate `spec`
+    std::vector<bool> blocksToRead(const GetCutJetsSpec& spec) const;
+
+    void save(const std::string& path) const;
+    static ZoneMap load(const std::string& path);
+};
+
+// Builds a ZoneMap from events fed to it by the file reader, starting a new block every `eventsPerBlock` events.
+class ZoneMapBuilder {
+    const Format& _format;
+    const size_t _eventsPerBlock;
+    ZoneMap _zoneMap;
+    size_t _eventsInBlock = 0;
+    size_t _numEvents = 0;
+    double _totalWeight = 0;
+
+    // State of the current event
+    double _weight = 0;
+    int _isGluon1 = 2;
+    int _isGluon2 = 2;
+    double _zData[5];
+
+public:
+    ZoneMapBuilder(const Format& format, size_t eventsPerBlock) : _format(format), _eventsPerBlock(eventsPerBlock) {
+        _zoneMap.vars = format.vars;
+    }
+
+    // Called with the file offset of each "New Event" line before the event begins
+    void atNewEvent(size_t offset) {
+        if (!_zoneMap.blocks.empty() && _eventsInBlock < _eventsPerBlock) {
+            return;
+        }
+        if (!_zoneMap.blocks.empty()) {
+            _zoneMap.blocks.back().endOffset = offset;
+        }
+        _zoneMap.blocks.push_back(ZoneMap::Block{
+            .startOffset = offset,
+            .endOffset = offset,
+            .eventsThrough = _numEvents,
+            .weightThrough = _totalWeight,
+            .crossSection = NAN,
+            .min = std::vector<double>(_format.numVars(), INFINITY),
+            .max = std::vector<double>(_format.numVars(), -INFINITY),
+        });
+        _eventsInBlock = 0;
+    }
+
+    // Finish the last block, which ends at the end of the file
+    ZoneMap finish(size_t inputSize) {
+        if (!_zoneMap.blocks.empty()) {
+            _zoneMap.blocks.back().endOffset = inputSize;
+        }
+        _zoneMap.inputSize = inputSize;
+        return std::move(_zoneMap);
+    }
+
+    // Interface used by the file reader
+
+    bool beginEvent(uint64_t /* eventIndex */, double weight, double crossSection) {
+        auto& block = _zoneMap.blocks.back();
+        ++_eventsInBlock;
+        block.eventsThrough = ++_numEvents;
+        block.weightThrough = _totalWeight += weight;
+        block.crossSection = crossSection;
+        _weight = weight;
+        _isGluon1 = 2;
+        _isGluon2 = 2;
+        std::fill_n(std::begin(_zData), 5, INFINITY);
+        return true;
+    }
+
+    void setGluonFlags(int isGluon1, int isGluon2) {
+        _isGluon1 = isGluon1;
+        _isGluon2 = isGluon2;
+    }
+
+    void setZData(const double (&zData)[5]) {
+        std::copy(std::begin(zData), std::end(zData), std::begin(_zData));
+    }
+
+    bool wantJet() {
+        return true;
+    }
+
+    void addJet(Jet&& jet) {
+        _format.insertEventData(jet, _weight, _zData, _isGluon1, _isGluon2);
+        auto& block = _zoneMap.blocks.back();
+        for (size_t v = 0; v < jet.size(); v++) {
+            block.min[v] = std::min(block.min[v], jet[v]);
+            block.max[v] = std::max(block.max[v], jet[v]);
+        }
+    }
+};
+
+// Read every event in the file and summarize it in blocks of `eventsPerBlock` events.
+ZoneMap buildZoneMap(const Format& format, const char* filename,
+                     size_t eventsPerBlock = ZoneMap::DEFAULT_EVENTS_PER_BLOCK);
@@ -3,76 +3,330 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <random>
+#include <sstream>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
+#include "EventStore.h"
+#include "Fingerprint.h"
 #include "LineReader.h"
+#include "SpscRing.h"
+#include "WorkStealingPool.h"
+#include "ZoneMap.h"
 #include "get_cuts.h"
 
 
-CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec) {
-    CutJetsResult result;
-    LineReader reader{filename};
-
-    bool useEventProbability = !std::isnan(spec.eventProbabilityMultiplier);
-    std::uniform_real_distribution randDouble(0.0, 1.0);
+CutJetsProcessor::CutJetsProcessor(const Format& format, const GetCutJetsSpec& spec)
+    : _format(format)
+    , _spec(spec)
+    , _useEventProbability(!std::isnan(spec.eventProbabilityMultiplier))
+    , _kernels(cpuKernels())
+    , _replicaWeights(spec.bootstrapReplicas)
+    , _jetsTaken(spec.cuts.size(), 0)
+    , _eventValues(format.numVars(), NAN)
+{
     std::seed_seq seed({spec.randomSeed});
-    std::mt19937_64 randEngine(seed);
+    _randEngine.seed(seed);
 
-    double crossSection = NAN;  // keep this outside the loop so we can return the last value
-
-    // result.jetsList.resize(cuts.size());
     // Initialize output histograms based on the specs for each cut
+    _result.cutResults.reserve(spec.cuts.size());
     for (const auto& cut : spec.cuts) {
-        result.cutResults.push_back(CutResult{
+        _result.cutResults.push_back(CutResult{
             .intHistograms = cut.intHistograms,
             .binHistograms = cut.binHistograms,
+            .quantileHistograms = cut.quantileHistograms,
         });
+        if (cut.scan) {
+            auto& cutResult = _result.cutResults.back();
+            size_t steps = cut.scan->thresholds.size();
+            cutResult.scan = cut.scan;
+            cutResult.scanWeights.assign(steps, 0);
+            cutResult.scanResults = std::vector<CutResult>(steps, CutResult{
+                .intHistograms = cut.intHistograms,
+                .binHistograms = cut.binHistograms,
+                .quantileHistograms = cut.quantileHistograms,
+            });
+        }
+        _arena.addGroup(cut.binHistograms);
+        _hasEventClauses |= !cut.eventClauses.empty();
     }
+}
+
+bool CutJetsProcessor::beginEvent(uint64_t eventIndex, double weight, double crossSection) {
+    if (_staging) {
+        commitStaged();
+        _committedEventIndex = _eventIndex;
+        _committedNumEvents = _result.numEvents;
+        _committedTotalWeight = _result.totalWeight;
+        _committedCrossSection = _crossSection;
+        if (_useEventProbability) {
+            _committedRandEngine = _randEngine;
+        }
+    }
+
+    _keepEvent = !_useEventProbability || _randDouble(_randEngine) < weight * _spec.eventProbabilityMultiplier;
+    _weight = weight;
+    _isGluon1 = 2;
+    _isGluon2 = 2;
+    std::fill_n(std::begin(_zData), 5, INFINITY);
+    _jetsSeen = 0;
+    for (size_t i : _touchedCuts) {
+        _jetsTaken[i] = 0;
+    }
+    _touchedCuts.clear();
+    _openCuts = _spec.takeNum > 0 ? _spec.cuts.size() : 0;
+    _eventClausesChecked = false;
+
+    if (_keepEvent) {
+        ++_result.numEvents;
+        _result.totalWeight += weight;
+        _crossSection = crossSection;
+        bootstrapWeights(_spec.randomSeed, eventIndex, _replicaWeights);
+    }
+    _eventIndex = eventIndex + 1;
+    return _keepEvent;
+}
+
+// Once the event-level data is known, rule out the cuts whose event-level clauses fail by treating them as having
+// taken all their jets, so that jets aren't read at all once no cut can match.
+void CutJetsProcessor::checkEventClauses() {
+    _eventClausesChecked = true;
+    if (!_hasEventClauses) {
+        return;
+    }
+
+    _eventValues[_format.weightInsertPoint] = jetWeight();
+    std::copy(std::begin(_zData), std::end(_zData), _eventValues.begin() + _format.zInsertPoint);
+    _eventValues[_format.flagInsertPoint] = _isGluon1;
+    _eventValues[_format.flagInsertPoint + 1] = _isGluon2;
+    _spec.computeDerivedForEventClauses(_eventValues);
+
+    for (size_t i = 0; i < _spec.cuts.size(); i++) {
+        const auto& clauses = _spec.cuts[i].eventClauses;
+        if (_jetsTaken[i] < _spec.takeNum && !_kernels.clausesMatch(clauses.data(), clauses.size(), _eventValues)) {
+            setJetsTaken(i, _spec.takeNum);
+        }
+    }
+}
+
+void CutJetsProcessor::skipTo(uint64_t eventIndex, double totalWeight, double crossSection) {
+    if (_useEventProbability || _staging) {
+        throw std::logic_error("skipTo() can't be used with sampling or staging");
+    }
+    _keepEvent = false;
+    _eventIndex = eventIndex;
+    _result.numEvents = eventIndex;
+    _result.totalWeight = totalWeight;
+    _crossSection = crossSection;
+}
+
+bool CutJetsProcessor::wantJet() {
+    if (!_keepEvent) {
+        return false;
+    }
+    if (!_eventClausesChecked) {
+        checkEventClauses();
+    }
+    _jetsSeen++;
+    if (_jetsSeen <= _spec.skipNum) {
+        // skip jets until skipNum is satisfied
+        return false;
+    }
+    if (_openCuts == 0) {
+        // skip all remaining jets once takeNum has been satisfied across all cuts
+        return false;
+    }
+    if (_spec.strict && _jetsSeen > _spec.skipNum + _spec.takeNum) {
+        // in strict mode, skip all remaining jets if takeNum jets have been considered
+        return false;
+    }
+    return true;
+}
+
+void CutJetsProcessor::addJet(Jet&& jet) {
+    if (evaluateJet(jet)) {
+        _stagedJets.push_back(std::move(jet));
+    }
+}
+
+void CutJetsProcessor::addJet(Jet& jet) {
+    if (evaluateJet(jet)) {
+        _stagedJets.push_back(jet);
+    }
+}
+
+// Match `jet` against the cuts and fill (or stage fills for) those it passes. Returns true if the jet has to be added
+// to _stagedJets.
+bool CutJetsProcessor::evaluateJet(Jet& jet) {
+    _format.insertEventData(jet, jetWeight(), _zData, _isGluon1, _isGluon2);
+    _spec.computeDerivedForClauses(jet);
+    if (!_eventClausesChecked) {
+        checkEventClauses();
+    }
+
+    bool matchedAny = false;
+    for (size_t i = 0; i < _spec.cuts.size() && _openCuts > 0; i++) {
+        if (_jetsTaken[i] >= _spec.takeNum) {
+            continue;
+        }
+
+        const auto& clauses = _spec.cuts[i].jetClauses;
+        if (_kernels.clausesMatch(clauses.data(), clauses.size(), jet)) {
+            if (!matchedAny) {
+                _spec.computeDerivedForHistograms(jet);
+                matchedAny = true;
+            }
+            setJetsTaken(i, _jetsTaken[i] + 1);
+            if (_staging) {
+                _stagedFills.push_back({i, _stagedJets.size()});
+            } else {
+                fill(i, jet);
+            }
+        }
+    }
+    return !_stagedFills.empty() && _stagedFills.back().jetIndex == _stagedJets.size();
+}
+
+void CutJetsProcessor::fill(size_t cutIndex, const Jet& jet) {
+    auto& cutResult = _result.cutResults[cutIndex];
+    ++cutResult.totalJetsTaken;
+    for (auto& hist : cutResult.intHistograms) {
+        hist.add(jetWeight(), jet, _replicaWeights.data());
+    }
+    for (auto& hist : cutResult.quantileHistograms) {
+        hist.add(jetWeight(), jet);
+    }
+    _arena.fill(cutIndex, jetWeight(), jet, _replicaWeights.data());
+    if (cutResult.scan) {
+        size_t step = cutResult.scan->step(jet[cutResult.scan->varIndex]);
+        cutResult.scanWeights[step] += jetWeight();
+        cutResult.scanResults[step].add(jetWeight(), jet, _replicaWeights.data());
+    }
+    if (_jetDump) {
+        _jetDump->add(cutIndex, _eventIndex - 1, jetWeight(), jet);
+    }
+}
+
+void CutJetsProcessor::commitStaged() {
+    for (const auto& staged : _stagedFills) {
+        fill(staged.cutIndex, _stagedJets[staged.jetIndex]);
+    }
+    _stagedFills.clear();
+    _stagedJets.clear();
+}
+
+void CutJetsProcessor::stageEvents() {
+    _staging = true;
+    _committedRandEngine = _randEngine;
+}
+
+void CutJetsProcessor::saveState(std::ostream& out) const {
+    if (!_staging) {
+        throw std::logic_error("saveState() requires stageEvents()");
+    }
+    out << "events " << _committedEventIndex << ' ' << _committedNumEvents << ' ';
+    writeExact(out, _committedTotalWeight);
+    out << ' ';
+    writeExact(out, _committedCrossSection);
+    out << "\nrandom " << _committedRandEngine << '\n';
+    for (size_t i = 0; i < _result.cutResults.size(); i++) {
+        CutResult cutResult = _result.cutResults[i];
+        _arena.store(i, cutResult.binHistograms);
+        cutResult.save(out);
+    }
+}
+
+void CutJetsProcessor::loadState(std::istream& in) {
+    expectWord(in, "events");
+    _eventIndex = _committedEventIndex = readInteger(in);
+    _result.numEvents = _committedNumEvents = readInteger(in);
+    _result.totalWeight = _committedTotalWeight = readExact(in);
+    _crossSection = _committedCrossSection = readExact(in);
+    expectWord(in, "random");
+    if (!(in >> _randEngine)) {
+        throw std::runtime_error("Expected random engine state in saved state");
+    }
+    _committedRandEngine = _randEngine;
+    for (size_t i = 0; i < _result.cutResults.size(); i++) {
+        _result.cutResults[i].load(in);
+        _arena.load(i, _result.cutResults[i].binHistograms);
+    }
+}
+
+CutJetsResult CutJetsProcessor::finish() {
+    CutJetsResult result = finishAccumulators();
+    result.finish();
+    return result;
+}
+
+CutJetsResult CutJetsProcessor::finishAccumulators() {
+    commitStaged();
+    for (size_t i = 0; i < _result.cutResults.size(); i++) {
+        _arena.store(i, _result.cutResults[i].binHistograms);
+        _result.cutResults[i].accumulateScan();
+    }
+    _result.csOnW = _crossSection / _result.totalWeight;
+    return std::move(_result);
+}
+
+CutJetsResult CutJetsProcessor::accumulators() const {
+    CutJetsResult result = _result;
+    for (size_t i = 0; i < result.cutResults.size(); i++) {
+        _arena.store(i, result.cutResults[i].binHistograms);
+        result.cutResults[i].accumulateScan();
+    }
+    result.csOnW = _crossSection / result.totalWeight;
+    return result;
+}
 
-    reader.nextLine(); // skip header line
 
+// Parse events from `reader`, which must be positioned just before a "New Event" line, and describe them to `sink` (a
+// CutJetsProcessor or EventStore). Jet lines are only parsed if the sink wants them. `atNewEvent` is called with the
+// file offset of each "New Event" line before the event is passed to the sink. The first event read is numbered
+// `eventIndex`, which is its position in the whole input.
+template<typename Sink, typename Fn>
+static void readEvents(const Format& format, LineReader& reader, Sink& sink, uint64_t eventIndex, Fn&& atNewEvent) {
     reader.nextLine();
     while (!reader.atEOF()) {
+        size_t eventOffset = reader.lineOffset();
         reader.skip("New Event");
-        reader.nextLine();
+        if (!reader.nextLine()) break;
+        atNewEvent(eventOffset);
 
         double weight = reader.readDouble();
         reader.skip(',');
-
-        bool keepEvent = !useEventProbability || randDouble(randEngine) < weight * spec.eventProbabilityMultiplier;
-
-        if (keepEvent) {
-            ++result.numEvents;
-            result.totalWeight += weight;
-            crossSection = reader.readDouble();
-        } else {
-            reader.readDouble();
-        }
+        double crossSection = reader.readDouble();
+        sink.beginEvent(eventIndex++, weight, crossSection);
 
         assert(reader.usedWholeLine());
 
         if (!reader.nextLine()) break;
 
-        // Data which get inserted into each jet in the event
-        int isGluon1 = 2;
-        int isGluon2 = 2;
-        double zData[5];
-        std::fill_n(std::begin(zData), 5, INFINITY);
-
         // Read gluon flag line if present
         if (reader.peek() == 'H') {
             reader.skip('H');
             reader.skipDouble<6>();
-            isGluon1 = reader.readDouble();
-            isGluon2 = reader.readDouble();
+            int isGluon1 = reader.readDouble();
+            int isGluon2 = reader.readDouble();
             assert(isGluon1 == 0 || isGluon1 == 1 || isGluon1 == 2 /* ??? */);
             assert(isGluon2 == 0 || isGluon2 == 1 || isGluon2 == 2 /* ??? */);
+            sink.setGluonFlags(isGluon1, isGluon2);
 
             if (!reader.nextLine()) break;
         }
@@ -81,73 +335,662 @@ CutJetsResult getCutJets(const Format& format, const char* filename, const GetCu
         if (reader.peek() == 'M') {
             double muData1[4];
             double muData2[4];
+            double zData[5];
 
             reader.skip('M');
             std::generate_n(std::begin(muData1), 4, [&] { return reader.readDouble(); });
-            if (!reader.nextLine()) throw std::runtime_error("Ended after first M line");
+            if (!reader.nextLine()) {
+                if (reader.isGrowing()) break;
+                throw std::runtime_error("Ended after first M line");
+            }
 
             reader.skip('M');
             std::generate_n(std::begin(muData2), 4, [&] { return reader.readDouble(); });
 
             std::transform(std::begin(muData1), std::end(muData1), std::begin(muData2), std::begin(zData), std::plus{});
             zData[4] = std::log((zData[3] + zData[2]) / (zData[3] - zData[2])) / 2.0;
+            sink.setZData(zData);
 
             if (!reader.nextLine()) break;
         }
 
         // Read all jets until the next new event
-        size_t jetsSeen = 0;
-        std::vector<size_t> jetsTaken(spec.cuts.size(), 0);
         do {
             if (reader.peek() == 'N') {  // new event
                 break;
             }
-            if (!keepEvent) {
-                continue;
-            }
-            jetsSeen++;
-            if (jetsSeen <= spec.skipNum) {
-                // skip jets until skipNum is satisfied
-                continue;
-            }
-            if (std::all_of(jetsTaken.begin(), jetsTaken.end(), [&](auto taken) { return taken >= spec.takeNum; })) {
-                // skip all remaining jets once takeNum has been satisfied across all cuts
-                continue;
-            }
-            if (spec.strict && jetsSeen > spec.skipNum + spec.takeNum) {
-                // in strict mode, skip all remaining jets if takeNum jets have been considered
+            if (!sink.wantJet()) {
                 continue;
             }
 
             Jet jet;
             jet.reserve(format.numVars());
             reader.readCommaSeparatedDoubles(&jet);
+            sink.addJet(std::move(jet));
+        } while (reader.nextLine());
+    }
+}
+
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         JetDumpWriter* jetDump) {
+    CutJetsProcessor processor(format, spec);
+    if (jetDump) {
+        processor.dumpJets(*jetDump);
+    }
+    readEvents(format, filename, processor);
+    return processor.finish();
+}
+
+void readEvents(const Format& format, const char* filename, CutJetsProcessor& processor) {
+    LineReader reader{filename};
+    reader.nextLine(); // skip header line
+    readEvents(format, reader, processor, 0, [](size_t) {});
+}
+
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         const ZoneMap& zoneMap) {
+    if (zoneMap.vars != format.vars) {
+        throw std::runtime_error("Zone map was built for a different format");
+    }
+    if (zoneMap.inputFingerprint != inputFingerprint(filename)) {
+        throw std::runtime_error(std::string("Zone map was built for a different version of ") + filename);
+    }
+    if (!std::isnan(spec.eventProbabilityMultiplier)) {
+        return getCutJets(format, filename, spec);
+    }
+
+    CutJetsProcessor processor(format, spec);
+    LineReader reader{filename};
+    const auto& blocks = zoneMap.blocks;
+    std::vector<bool> toRead = zoneMap.blocksToRead(spec);
+
+    // Alternately skip the blocks that can't match and read each run of blocks that may. The last range read always
+    // reaches the end of the file (even if it's empty), which finishes the progress bar.
+    size_t b = 0;
+    do {
+        for (; b < blocks.size() && !toRead[b]; b++) {
+            processor.skipTo(blocks[b].eventsThrough, blocks[b].weightThrough, blocks[b].crossSection);
+        }
+        size_t first = b;
+        for (; b < blocks.size() && toRead[b]; b++) {}
+        reader.setRange(first < blocks.size() ? blocks[first].startOffset : zoneMap.inputSize,
+                        b > first ? blocks[b - 1].endOffset : zoneMap.inputSize);
+        readEvents(format, reader, processor, processor.nextEventIndex(), [](size_t) {});
+    } while (b < blocks.size());
+
+    return processor.finish();
+}
+
+ZoneMap buildZoneMap(const Format& format, const char* filename, size_t eventsPerBlock) {
+    LineReader reader{filename};
+    ZoneMapBuilder builder(format, eventsPerBlock);
+    reader.nextLine(); // skip header line
+    readEvents(format, reader, builder, 0, [&](size_t eventOffset) { builder.atNewEvent(eventOffset); });
+    ZoneMap zoneMap = builder.finish(std::filesystem::file_size(filename));
+    zoneMap.inputFingerprint = inputFingerprint(filename);
+    return zoneMap;
+}
+
+static const size_t PIPELINE_CHUNK_BYTES = size_t(1) << 20;
+static const size_t PIPELINE_NUM_CHUNKS = 8;
+static const size_t PIPELINE_BATCH_EVENTS = 1024;
+static const size_t PIPELINE_NUM_BATCHES = 8;
+
+// Thrown inside a pipeline stage to unwind it once another stage has failed
+struct PipelineCancelled {};
+
+// Collects the events described by the file reader into batches, handing each batch to the next stage when it's full
+class BatchingSink {
+    SpscRing<EventStore*>& _full;
+    SpscRing<EventStore*>& _free;
+    EventStore* _batch = nullptr;
+
+public:
+    BatchingSink(SpscRing<EventStore*>& full, SpscRing<EventStore*>& free) : _full(full), _free(free) {
+        if (!_free.pop(_batch)) {
+            throw PipelineCancelled();
+        }
+    }
 
-            jet.insert(jet.begin() + format.weightInsertPoint, useEventProbability ? 1.0 : weight);
-            jet.insert(jet.begin() + format.zInsertPoint, std::begin(zData), std::end(zData));
-            jet.insert(jet.begin() + format.flagInsertPoint, isGluon1);
-            jet.insert(jet.begin() + format.flagInsertPoint + 1, isGluon2);
+    // Hand off the last batch, followed by nullptr to mark the end
+    void finish() {
+        if (_batch->numEvents() > 0 && !_full.push(_batch)) {
+            throw PipelineCancelled();
+        }
+        _full.push(nullptr);
+    }
+
+    bool beginEvent(uint64_t eventIndex, double weight, double crossSection) {
+        if (_batch->numEvents() == PIPELINE_BATCH_EVENTS) {
+            if (!_full.push(_batch) || !_free.pop(_batch)) {
+                throw PipelineCancelled();
+            }
+            _batch->clear();
+        }
+        return _batch->beginEvent(eventIndex, weight, crossSection);
+    }
+
+    void setGluonFlags(int isGluon1, int isGluon2) {
+        _batch->setGluonFlags(isGluon1, isGluon2);
+    }
+
+    void setZData(const double (&zData)[5]) {
+        _batch->setZData(zData);
+    }
+
+    bool wantJet() {
+        return true;
+    }
+
+    void addJet(Jet&& jet) {
+        _batch->addJet(std::move(jet));
+    }
+};
+
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         PipelineStats& stats) {
+    using Clock = std::chrono::steady_clock;
+    auto seconds = [](Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); };
+    auto start = Clock::now();
+    std::atomic<bool> cancelled{false};
+
+    // Each link between stages is a ring of filled buffers and a ring of empty ones to return them. The rings have
+    // room for every buffer plus an end marker, so only waiting for an empty buffer can block.
+    struct Chunk {
+        char* data = nullptr;  // nullptr marks the end of the input, or an error reading it
+        size_t size = 0;
+    };
+    std::vector<std::unique_ptr<char[]>> chunkData;
+    SpscRing<Chunk> fullChunks(PIPELINE_NUM_CHUNKS * 2, cancelled);
+    SpscRing<Chunk> freeChunks(PIPELINE_NUM_CHUNKS * 2, cancelled);
+    for (size_t i = 0; i < PIPELINE_NUM_CHUNKS; i++) {
+        chunkData.emplace_back(new char[PIPELINE_CHUNK_BYTES]);
+        freeChunks.push(Chunk{chunkData.back().get(), 0});
+    }
+    std::vector<EventStore> batches(PIPELINE_NUM_BATCHES, EventStore(format));
+    SpscRing<EventStore*> fullBatches(PIPELINE_NUM_BATCHES * 2, cancelled);
+    SpscRing<EventStore*> freeBatches(PIPELINE_NUM_BATCHES * 2, cancelled);
+    for (auto& batch : batches) {
+        freeBatches.push(&batch);
+    }
+
+    // Read the raw input in chunks
+    std::exception_ptr readError;
+    double readSeconds = 0;
+    std::thread readStage([&] {
+        auto readStart = Clock::now();
+        try {
+            std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::fopen(filename, "r"), std::fclose);
+            if (!file) {
+                throw std::system_error(errno, std::system_category(), std::string("Error opening ") + filename);
+            }
+            Chunk chunk;
+            while (freeChunks.pop(chunk)) {
+                chunk.size = std::fread(chunk.data, 1, PIPELINE_CHUNK_BYTES, file.get());
+                if (chunk.size == 0 && std::ferror(file.get())) {
+                    throw std::system_error(errno, std::system_category(), "Error reading from file");
+                }
+                if (chunk.size == 0) {
+                    chunk.data = nullptr;
+                }
+                if (!fullChunks.push(chunk) || !chunk.data) {
+                    break;
+                }
+            }
+        } catch (...) {
+            readError = std::current_exception();
+            fullChunks.push(Chunk{});
+        }
+        readSeconds = seconds(readStart);
+    });
+
+    // Split the chunks into lines, parse them, and assemble the events into batches
+    std::exception_ptr parseError;
+    double parseSeconds = 0;
+    std::thread parseStage([&] {
+        auto parseStart = Clock::now();
+        try {
+            Chunk chunk;
+            size_t chunkPos = 0;
+            bool ended = false;
+            std::error_code sizeError;  // the size of a pipe isn't known, which only affects the progress bar
+            size_t inputSize = std::filesystem::file_size(filename, sizeError);
+            LineReader reader(filename, sizeError ? 0 : inputSize, [&](char* buf, size_t size) -> size_t {
+                while (!ended && chunkPos == chunk.size) {
+                    if (chunk.data) {
+                        freeChunks.push(chunk);
+                    }
+                    if (!fullChunks.pop(chunk)) {
+                        throw PipelineCancelled();
+                    }
+                    chunkPos = 0;
+                    ended = !chunk.data;
+                }
+                if (ended) {
+                    if (readError) {
+                        std::rethrow_exception(readError);
+                    }
+                    return 0;
+                }
+                size_t n = std::min(size, chunk.size - chunkPos);
+                std::memcpy(buf, chunk.data + chunkPos, n);
+                chunkPos += n;
+                return n;
+            });
+            BatchingSink sink(fullBatches, freeBatches);
+            reader.nextLine(); // skip header line
+            readEvents(format, reader, sink, 0, [](size_t) {});
+            sink.finish();
+        } catch (const PipelineCancelled&) {
+        } catch (...) {
+            // Stop the read stage too, which would otherwise wait forever for the chunks this stage holds
+            parseError = std::current_exception();
+            fullBatches.push(nullptr);
+            cancelled = true;
+        }
+        parseSeconds = seconds(parseStart);
+    });
+
+    // Evaluate the cuts on each batch in order
+    CutJetsProcessor processor(format, spec);
+    try {
+        EventStore* batch;
+        while (fullBatches.pop(batch) && batch) {
+            batch->replay(processor);
+            freeBatches.push(batch);
+        }
+    } catch (...) {
+        cancelled = true;
+        readStage.join();
+        parseStage.join();
+        throw;
+    }
+    double evaluateSeconds = seconds(start);
+    readStage.join();
+    parseStage.join();
+    if (parseError) {
+        std::rethrow_exception(parseError);
+    }
+
+    stats.wallSeconds = seconds(start);
+    stats.stages = {
+        {"read", 0, 0, freeChunks.popWaitSeconds + fullChunks.pushWaitSeconds},
+        {"parse", 0, fullChunks.popWaitSeconds, freeBatches.popWaitSeconds + fullBatches.pushWaitSeconds},
+        {"evaluate", 0, fullBatches.popWaitSeconds, 0},
+    };
+    double stageSeconds[] = {readSeconds, parseSeconds, evaluateSeconds};
+    for (size_t i = 0; i < 3; i++) {
+        auto& stage = stats.stages[i];
+        stage.busySeconds = stageSeconds[i] - stage.inputWaitSeconds - stage.outputWaitSeconds;
+    }
+    return processor.finish();
+}
+
+static const size_t CHECKPOINT_INTERVAL_BYTES = size_t(256) << 20;
+
+static std::string checkpointHeader(const Format& format, const GetCutJetsSpec& spec) {
+    std::ostringstream out;
+    out << "vars";
+    for (const auto& var : format.vars) {
+        out << ' ' << var;
+    }
+    out << '\n' << spec.canonical(format);
+    return out.str();
+}
+
+static void writeCheckpoint(const std::string& path, const std::string& header, const CutJetsProcessor& processor,
+                            size_t offset) {
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath);
+        out << "get_cuts_checkpoint 2\n" << header.size() << '\n' << header << "offset " << offset << '\n';
+        processor.saveState(out);
+        if (!out.flush()) {
+            throw std::system_error(errno, std::system_category(), "Error writing checkpoint " + tmpPath);
+        }
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw std::system_error(errno, std::system_category(), "Error replacing checkpoint " + path);
+    }
+}
+
+// Restore `processor` from the checkpoint and return the offset to resume reading from.
+static size_t readCheckpoint(std::istream& in, const std::string& header, CutJetsProcessor& processor) {
+    expectWord(in, "get_cuts_checkpoint");
+    if (readInteger(in) != 2) {
+        throw std::runtime_error("Unsupported checkpoint version");
+    }
+    std::string savedHeader(readInteger(in), '\0');
+    in.ignore(1);
+    in.read(savedHeader.data(), savedHeader.size());
+    if (savedHeader != header) {
+        throw std::runtime_error("Checkpoint was written for a different format or spec");
+    }
+    expectWord(in, "offset");
+    size_t offset = readInteger(in);
+    processor.loadState(in);
+    return offset;
+}
+
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         const std::string& checkpointPath) {
+    CutJetsProcessor processor(format, spec);
+    processor.stageEvents();
+    std::string header = checkpointHeader(format, spec);
+
+    size_t offset = 0;  // a checkpoint at offset 0 has not seen any events
+    if (std::ifstream in(checkpointPath); in) {
+        offset = readCheckpoint(in, header, processor);
+    }
+
+    LineReader reader{filename, offset};
+    reader.setGrowing();
+    if (offset == 0) {
+        reader.nextLine(); // skip header line
+    }
+
+    // The staged event may be incomplete if we've reached the end of a file that's still being written, so
+    // checkpoints always resume from its start.
+    size_t stagedEventOffset = offset;
+    size_t lastCheckpointOffset = offset;
+    readEvents(format, reader, processor, processor.nextEventIndex(), [&](size_t eventOffset) {
+        if (stagedEventOffset - lastCheckpointOffset >= CHECKPOINT_INTERVAL_BYTES) {
+            writeCheckpoint(checkpointPath, header, processor, stagedEventOffset);
+            lastCheckpointOffset = stagedEventOffset;
+        }
+        stagedEventOffset = eventOffset;
+    });
+    writeCheckpoint(checkpointPath, header, processor, stagedEventOffset);
+
+    return processor.finish();
+}
+
+EventStore loadEvents(const Format& format, const char* filename) {
+    LineReader reader{filename};
+    EventStore store(format);
+    reader.nextLine(); // skip header line
+    readEvents(format, reader, store, 0, [](size_t) {});
+    return store;
+}
 
-            if (jet.size() != format.numVars()) {
-                throw std::length_error(
-                    std::string("Expected jet to have ") + std::to_string(format.numVars()) +
-                    " values, but encountered " + std::to_string(jet.size()));
+// Call fn(eventOffset) with the offset of each "New Event" line after the one containing `offset` - 1 (so a line
+// starting exactly at `offset` counts but the header line never does), in order, until it returns false.
+template<typename Fn>
+static void forEachEventOffset(const char* filename, size_t offset, Fn&& fn) {
+    static const char PATTERN[] = "\nNew Event";
+    static const size_t PATTERN_SIZE = sizeof(PATTERN) - 1;
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(std::fopen(filename, "r"), std::fclose);
+    if (!file) {
+        throw std::system_error(errno, std::system_category(), std::string("Error opening ") + filename);
+    }
+    size_t pos = offset > 0 ? offset - 1 : 0;
+    if (std::fseek(file.get(), pos, SEEK_SET) != 0) {
+        throw std::system_error(errno, std::system_category(), "Error seeking to chunk boundary");
+    }
+    std::vector<char> buf(size_t(1) << 16);
+    size_t kept = 0;  // bytes at the front of buf carried over from the previous read, which may start a match
+    while (size_t n = std::fread(buf.data() + kept, 1, buf.size() - kept, file.get())) {
+        size_t size = kept + n;
+        for (auto found = buf.begin();; ++found) {
+            found = std::search(found, buf.begin() + size, PATTERN, PATTERN + PATTERN_SIZE);
+            if (found == buf.begin() + size) {
+                break;
+            }
+            if (!fn(pos + (found - buf.begin()) + 1)) {
+                return;
             }
+        }
+        kept = std::min(size, PATTERN_SIZE - 1);
+        std::copy(buf.begin() + size - kept, buf.begin() + size, buf.begin());
+        pos += size - kept;
+    }
+    if (std::ferror(file.get())) {
+        throw std::system_error(errno, std::system_category(), "Error reading from file");
+    }
+}
+
+// Offset of the first "New Event" line from `offset`, as forEachEventOffset(). Returns the file size if there's none.
+static size_t nextEventOffset(const char* filename, size_t offset) {
+    size_t next = std::filesystem::file_size(filename);
+    forEachEventOffset(filename, offset, [&](size_t eventOffset) {
+        next = eventOffset;
+        return false;
+    });
+    return next;
+}
+
+MultiSampleResult getCutJets(const Format& format, const std::vector<std::string>& inputs,
+                             const GetCutJetsSpec& spec, size_t numThreads, size_t chunkBytes) {
+    // Sampling and bootstrap replicas depend on each event's position in its input, so then every input has to be
+    // read in order as one task. Each sample gets its own seed so that they're independent.
+    bool inOrder = !std::isnan(spec.eventProbabilityMultiplier) || spec.bootstrapReplicas > 0;
+    std::vector<GetCutJetsSpec> sampleSpecs;
+    if (inOrder) {
+        for (size_t i = 0; i < inputs.size(); i++) {
+            sampleSpecs.push_back(spec);
+            sampleSpecs.back().randomSeed += i;
+        }
+    }
 
-            for (size_t i = 0; i < spec.cuts.size(); i++) {
-                if (jetsTaken[i] >= spec.takeNum) {
-                    continue;
+    struct Task {
+        size_t sample;
+        size_t chunk;
+        size_t start;
+        size_t end;
+    };
+    struct ChunkResult {
+        CutJetsResult accumulators;
+        double crossSection;
+    };
+    WorkStealingPool<Task> pool(numThreads > 0 ? numThreads : std::thread::hardware_concurrency());
+    std::vector<std::vector<std::optional<ChunkResult>>> chunkResults(inputs.size());
+    size_t numTasks = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const char* filename = inputs[i].c_str();
+        size_t fileSize = std::filesystem::file_size(filename);
+        for (size_t start = nextEventOffset(filename, 0); start < fileSize;) {
+            size_t end = inOrder ? fileSize : nextEventOffset(filename, std::max(start + 1, start + chunkBytes));
+            pool.add(numTasks++, {i, chunkResults[i].size(), start, end});
+            chunkResults[i].emplace_back();
+            start = end;
+        }
+    }
+
+    pool.run([&](const Task& task, size_t) {
+        CutJetsProcessor processor(format, inOrder ? sampleSpecs[task.sample] : spec);
+        LineReader reader{inputs[task.sample].c_str()};
+        reader.hideProgress();
+        reader.setRange(task.start, task.end);
+        // Events' positions only matter for bootstrap replicas, with which each input is read as a single task
+        readEvents(format, reader, processor, 0, [](size_t) {});
+        double crossSection = processor.crossSection();
+        chunkResults[task.sample][task.chunk] = ChunkResult{processor.finishAccumulators(), crossSection};
+    });
+
+    MultiSampleResult result;
+    result.inputs = inputs;
+    result.numTasks = numTasks;
+    result.steals = pool.steals();
+    for (size_t i = 0; i < inputs.size(); i++) {
+        // Add up the chunks in input order; the last one with any events has the sample's cross section
+        CutJetsResult sample;
+        double crossSection = NAN;
+        for (auto& chunk : chunkResults[i]) {
+            auto& accumulators = chunk->accumulators;
+            if (&chunk == &chunkResults[i].front()) {
+                sample = std::move(accumulators);
+            } else {
+                sample.numEvents += accumulators.numEvents;
+                sample.totalWeight += accumulators.totalWeight;
+                for (size_t c = 0; c < sample.cutResults.size(); c++) {
+                    sample.cutResults[c].merge(accumulators.cutResults[c]);
                 }
+            }
+            if (!std::isnan(chunk->crossSection)) {
+                crossSection = chunk->crossSection;
+            }
+        }
+        if (chunkResults[i].empty()) {
+            sample = CutJetsProcessor(format, inOrder ? sampleSpecs[i] : spec).finishAccumulators();
+        }
+        sample.csOnW = crossSection / sample.totalWeight;
+
+        // Weight the sample's accumulators by csOnW for the combination, leaving out samples without any weight
+        double factor = sample.totalWeight > 0 && std::isfinite(sample.csOnW) ? sample.csOnW : 0;
+        CutJetsResult scaled = sample;
+        for (auto& cutResult : scaled.cutResults) {
+            cutResult.scale(factor);
+        }
+        if (i == 0) {
+            result.combined = std::move(scaled);
+            result.combined.totalWeight = 0;
+        } else {
+            result.combined.numEvents += scaled.numEvents;
+            for (size_t c = 0; c < scaled.cutResults.size(); c++) {
+                result.combined.cutResults[c].merge(scaled.cutResults[c]);
+            }
+        }
+        result.combined.totalWeight += factor * sample.totalWeight;
+
+        sample.finish();
+        result.samples.push_back(std::move(sample));
+    }
+    result.combined.csOnW = 1;
+    result.combined.finish();
+    return result;
+}
 
-                if (spec.cuts[i].matches(jet)) {
-                    jetsTaken[i]++;
-                    result.cutResults[i].add(useEventProbability ? 1.0 : weight, jet);
+// Largest relative error of a nonempty bin in the histograms of `variables` (all if empty) in finished `result`
+static double maxRelativeError(const CutJetsResult& result, const std::vector<std::string>& variables) {
+    double maxError = 0;
+    auto watch = [&](const std::string& varName, auto&& eachBin) {
+        if (!variables.empty() && std::find(variables.begin(), variables.end(), varName) == variables.end()) {
+            return;
+        }
+        bool anyBins = false;
+        eachBin([&](double sum, double err) {
+            if (sum != 0) {
+                maxError = std::max(maxError, err / std::abs(sum));
+                anyBins = true;
+            }
+        });
+        if (!anyBins) {
+            maxError = INFINITY;
+        }
+    };
+    for (const auto& cutResult : result.cutResults) {
+        for (const auto& hist : cutResult.intHistograms) {
+            watch(hist.varName, [&](auto&& bin) {
+                for (const auto& [k, sum] : hist.binSums) {
+                    bin(sum, hist.binErrs.at(k));
+                }
+            });
+        }
+        for (const auto& hist : cutResult.binHistograms) {
+            watch(hist.varName, [&](auto&& bin) {
+                for (size_t i = 0; i < hist.binSums.size(); i++) {
+                    bin(hist.binSums[i], hist.binErrs[i]);
                 }
+            });
+        }
+        for (const auto& hist : cutResult.quantileHistograms) {
+            watch(hist.varName, [&](auto&& bin) {
+                for (size_t i = 0; i < hist.binSums.size(); i++) {
+                    bin(hist.binSums[i], hist.binErrs[i]);
+                }
+            });
+        }
+    }
+    return maxError;
+}
+
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         const ProgressiveOptions& options, ProgressiveStatus& status) {
+    for (const auto& varName : options.variables) {
+        bool found = std::any_of(spec.cuts.begin(), spec.cuts.end(), [&](const Cut& cut) {
+            auto hasVar = [&](const auto& hists) {
+                return std::any_of(hists.begin(), hists.end(), [&](const auto& h) { return h.varName == varName; });
+            };
+            return hasVar(cut.intHistograms) || hasVar(cut.binHistograms) || hasVar(cut.quantileHistograms);
+        });
+        if (!found) {
+            throw std::runtime_error("No histogram of " + varName + " in spec");
+        }
+    }
+
+    struct Block {
+        size_t index;  // in input order
+        size_t start;
+        size_t end;
+        uint64_t firstEventIndex = 0;  // position of the block's first event in the input
+    };
+    std::vector<Block> blocks;
+    size_t fileSize = std::filesystem::file_size(filename);
+    size_t firstEvent = nextEventOffset(filename, 0);
+    for (size_t start = firstEvent; start < fileSize;) {
+        size_t end = nextEventOffset(filename, std::max(start + 1, start + options.blockBytes));
+        blocks.push_back({blocks.size(), start, end});
+        start = end;
+    }
+    // Bootstrap replicas depend on each event's position, so then count the events before each block, in a scan of
+    // the whole input for "New Event" lines that's much quicker than reading it. Nothing else needs the positions.
+    if (spec.bootstrapReplicas > 0 && !blocks.empty()) {
+        size_t b = 0;
+        uint64_t numEvents = 0;
+        forEachEventOffset(filename, firstEvent, [&](size_t eventOffset) {
+            for (; b + 1 < blocks.size() && eventOffset >= blocks[b + 1].start; b++) {
+                blocks[b + 1].firstEventIndex = numEvents;
             }
-        } while (reader.nextLine());
+            numEvents++;
+            return true;
+        });
     }
+    std::seed_seq seed({spec.randomSeed});
+    std::mt19937_64 engine(seed);
+    std::shuffle(blocks.begin(), blocks.end(), engine);
 
-    result.csOnW = crossSection / result.totalWeight;
-    result.finish();
+    status = ProgressiveStatus();
+    status.numBlocks = blocks.size();
+    size_t blocksPerUpdate = options.blocksPerUpdate > 0 ? options.blocksPerUpdate
+                                                         : std::max<size_t>(1, blocks.size() / 50);
+
+    // The cross section is a running estimate in some samples, so take it from the furthest block read so far
+    CutJetsProcessor processor(format, spec);
+    double crossSection = NAN;
+    size_t furthestBlock = 0;
+    size_t bytesRead = 0;
+    auto interim = [&] {
+        CutJetsResult result = processor.accumulators();
+        result.csOnW = crossSection / result.totalWeight;
+        result.finish();
+        return result;
+    };
+    for (const auto& block : blocks) {
+        LineReader reader{filename};
+        reader.hideProgress();
+        reader.setRange(block.start, block.end);
+        readEvents(format, reader, processor, block.firstEventIndex, [](size_t) {});
+        if (std::isnan(crossSection) || block.index > furthestBlock) {
+            crossSection = processor.crossSection();
+            furthestBlock = block.index;
+        }
+        bytesRead += block.end - block.start;
+        status.blocksRead++;
+        status.fractionRead = double(bytesRead) / (fileSize - firstEvent);
+
+        if (status.blocksRead % blocksPerUpdate == 0 || status.blocksRead == blocks.size()) {
+            CutJetsResult result = interim();
+            status.maxRelativeError = maxRelativeError(result, options.variables);
+            result.progressive = status;
+            if (options.onUpdate) {
+                options.onUpdate(result, status);
+            }
+            if (status.maxRelativeError <= options.targetRelativeError || status.blocksRead == blocks.size()) {
+                return result;
+            }
+        }
+    }
+    CutJetsResult result = interim();  // an input without any events
+    result.progressive = status;
     return result;
 }
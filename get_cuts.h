@@ -4,14 +4,29 @@
 #error "This file requires C++17"
 #endif
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <istream>
+#include <optional>
+#include <ostream>
+#include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "CpuDispatch.h"
+#include "Expression.h"
 #include "Histogram.h"
+#include "HistogramArena.h"
 #include "Jet.h"
+#include "JetDump.h"
+#include "Serialization.h"
+
+struct ZoneMap;
 
 inline size_t indexOf(const std::vector<std::string>& v, const std::string& x) {
     if (auto found = std::find(v.begin(), v.end(), x); found != v.end()) {
@@ -37,9 +52,46 @@ struct Format {
         return vars.size();
     }
 
+    // Number of values in each jet line of an input file, which doesn't have the 8 event-level ones
+    size_t numJetValues() const {
+        return vars.size() - 8;
+    }
+
     size_t var(const std::string& name) const {
         return indexOf(vars, name);
     }
+
+    // True for variables which have the same value for every jet in an event: the weight, Z data, and gluon flags
+    bool isEventLevel(size_t varIndex) const {
+        return varIndex == weightInsertPoint || (varIndex >= zInsertPoint && varIndex < zInsertPoint + 5) ||
+               varIndex == flagInsertPoint || varIndex == flagInsertPoint + 1;
+    }
+
+    // Insert the event-level data into a jet as it appears in the input, checking that the result has every variable
+    void insertEventData(Jet& jet, double weight, const double (&zData)[5], int isGluon1, int isGluon2) const {
+        jet.insert(jet.begin() + weightInsertPoint, weight);
+        jet.insert(jet.begin() + zInsertPoint, std::begin(zData), std::end(zData));
+        jet.insert(jet.begin() + flagInsertPoint, isGluon1);
+        jet.insert(jet.begin() + flagInsertPoint + 1, isGluon2);
+
+        if (jet.size() != numVars()) {
+            throw std::length_error(
+                std::string("Expected jet to have ") + std::to_string(numVars()) +
+                " values, but encountered " + std::to_string(jet.size()));
+        }
+    }
+};
+
+// A variable computed from others with `define: NAME = expr`. Derived variables are appended to each jet after the
+// Format's variables, in the order they were defined.
+struct DerivedVariable {
+    std::string name;
+    size_t varIndex;
+    Expression expression;
+    bool eventLevel = false;  // depends only on event-level variables
+    bool neededByEventClauses = false;  // must be computed before checking a cut's event-level clauses
+    bool neededByClauses = false;  // must be computed before checking cuts against each jet
+    bool neededByHistograms = false;  // must be computed before filling histograms
 };
 
 struct CutClause {
@@ -59,15 +111,48 @@ struct CutClause {
     }
 };
 
+// A `scan: VAR lo hi steps` directive, which gives a cut's results with each of `steps` evenly spaced lower bounds on
+// VAR from lo to hi. The cut selects jets against the lowest threshold, and each jet taken is counted at every
+// threshold it passes. So the results at a higher threshold are exactly those of a cut with that lower bound only
+// when the bound doesn't change which jets takeNum picks: an event's jets that fail it aren't replaced by later ones
+// that pass. That holds if takeNum is larger than the number of jets, or if jets are in decreasing order of VAR (like
+// pT). The results are added up in a different order than a separate cut's would be, so may differ by rounding.
+struct Scan {
+    std::string varName;
+    size_t varIndex;
+    std::vector<double> thresholds;
+
+    Scan(const std::string& varName, size_t varIndex, double lo, double hi, size_t steps)
+        : varName(varName)
+        , varIndex(varIndex)
+    {
+        if (steps < 2 || !(lo < hi)) {
+            throw std::invalid_argument("Scan must have at least 2 steps from a lower to a higher threshold");
+        }
+        for (size_t i = 0; i < steps; i++) {
+            thresholds.push_back(lo + (hi - lo) * i / (steps - 1));
+        }
+    }
+
+    // Index of the highest threshold that `value` reaches, which must be at least the lowest
+    size_t step(double value) const {
+        return std::upper_bound(thresholds.begin(), thresholds.end(), value) - thresholds.begin() - 1;
+    }
+};
+
 struct Cut {
     std::vector<CutClause> clauses;
+    // The clauses split by whether they depend only on event-level variables, so those can be checked once per event.
+    // These include the scan's lowest threshold.
+    std::vector<CutClause> eventClauses;
+    std::vector<CutClause> jetClauses;
+    std::optional<Scan> scan;
     std::vector<IntHistogram> intHistograms;
     std::vector<BinHistogram> binHistograms;
+    std::vector<QuantileHistogram> quantileHistograms;
 
     bool matches(const Jet& jet) const {
-        return std::all_of(clauses.begin(), clauses.end(), [&](const auto& clause) {
-            return clause.matches(jet);
-        });
+        return cpuKernels().clausesMatch(clauses.data(), clauses.size(), jet);
     }
 };
 
@@ -75,17 +160,105 @@ struct CutResult {
     size_t totalJetsTaken = 0;
     std::vector<IntHistogram> intHistograms;
     std::vector<BinHistogram> binHistograms;
+    std::vector<QuantileHistogram> quantileHistograms;
+
+    // For a cut with a scan, the total weight of the jets taken and the results at each threshold. Until
+    // accumulateScan() is called, each entry only has the jets below the next threshold.
+    std::optional<Scan> scan;
+    std::vector<double> scanWeights;
+    std::vector<CutResult> scanResults;
 
-    void add(double weight, const Jet& jet) {
+    // Add a jet to each histogram directly (the processor fills the cut's binHistograms through its HistogramArena)
+    void add(double weight, const Jet& jet, const double* replicaWeights) {
         ++totalJetsTaken;
         for (auto& hist : intHistograms) {
-            hist.add(weight, jet);
+            hist.add(weight, jet, replicaWeights);
         }
         for (auto& hist : binHistograms) {
+            hist.add(weight, jet, replicaWeights);
+        }
+        for (auto& hist : quantileHistograms) {
             hist.add(weight, jet);
         }
     }
 
+    void merge(const CutResult& other) {
+        totalJetsTaken += other.totalJetsTaken;
+        for (size_t i = 0; i < intHistograms.size(); i++) {
+            intHistograms[i].merge(other.intHistograms[i]);
+        }
+        for (size_t i = 0; i < binHistograms.size(); i++) {
+            binHistograms[i].merge(other.binHistograms[i]);
+        }
+        for (size_t i = 0; i < quantileHistograms.size(); i++) {
+            quantileHistograms[i].merge(other.quantileHistograms[i]);
+        }
+        for (size_t i = 0; i < scanResults.size(); i++) {
+            scanWeights[i] += other.scanWeights[i];
+            scanResults[i].merge(other.scanResults[i]);
+        }
+    }
+
+    // Multiply the un-normalized accumulators as if every weight had been multiplied by `factor`
+    void scale(double factor) {
+        for (auto& hist : intHistograms) {
+            hist.scale(factor);
+        }
+        for (auto& hist : binHistograms) {
+            hist.scale(factor);
+        }
+        for (auto& hist : quantileHistograms) {
+            hist.scale(factor);
+        }
+        for (size_t i = 0; i < scanResults.size(); i++) {
+            scanWeights[i] *= factor;
+            scanResults[i].scale(factor);
+        }
+    }
+
+    // Turn the scan's per-interval results into the results at each threshold
+    void accumulateScan() {
+        for (size_t i = scanResults.size(); i-- > 1;) {
+            scanWeights[i - 1] += scanWeights[i];
+            scanResults[i - 1].merge(scanResults[i]);
+        }
+    }
+
+    // Save or restore the un-normalized accumulators (before finish() is called)
+    void save(std::ostream& out) const {
+        out << totalJetsTaken << '\n';
+        for (const auto& hist : intHistograms) {
+            hist.save(out);
+        }
+        for (const auto& hist : binHistograms) {
+            hist.save(out);
+        }
+        for (const auto& hist : quantileHistograms) {
+            hist.save(out);
+        }
+        for (size_t i = 0; i < scanResults.size(); i++) {
+            writeExact(out, scanWeights[i]);
+            out << ' ';
+            scanResults[i].save(out);
+        }
+    }
+    void load(std::istream& in) {
+        totalJetsTaken = readInteger(in);
+        for (auto& hist : intHistograms) {
+            hist.load(in);
+        }
+        for (auto& hist : binHistograms) {
+            hist.load(in);
+        }
+        for (auto& hist : quantileHistograms) {
+            hist.load(in);
+        }
+        for (size_t i = 0; i < scanResults.size(); i++) {
+            scanWeights[i] = readExact(in);
+            scanResults[i].load(in);
+        }
+    }
+
     void finish() {
         for (auto& hist : intHistograms) {
             hist.finish();
@@ -93,14 +266,29 @@ struct CutResult {
         for (auto& hist : binHistograms) {
             hist.finish();
         }
+        for (auto& hist : quantileHistograms) {
+            hist.finish();
+        }
+        for (auto& scanResult : scanResults) {
+            scanResult.finish();
+        }
     }
 };
 
+// Where a progressive getCutJets stands after reading some of its input's blocks
+struct ProgressiveStatus {
+    size_t blocksRead = 0;
+    size_t numBlocks = 0;
+    double fractionRead = 0;  // of the bytes holding events
+    double maxRelativeError = INFINITY;  // over the nonempty bins of the watched histograms
+};
+
 struct CutJetsResult {
     double csOnW = 0;
     double totalWeight = 0;
     size_t numEvents = 0;
     std::vector<CutResult> cutResults;
+    std::optional<ProgressiveStatus> progressive;  // how much of the input a progressive getCutJets read
 
     void finish() {
         for (auto& cutResult : cutResults) {
@@ -109,52 +297,119 @@ struct CutJetsResult {
     }
 };
 
+// Splits a spec into whitespace-separated words, reading straight from the stream's buffer instead of with >>, which
+// dominates loading specs with very many cuts. The word returned is only valid until the next call.
+class SpecReader {
+    std::streambuf& _buf;
+    std::string _word;
+
+    static bool isSpace(int c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+public:
+    explicit SpecReader(std::istream& stream) : _buf(*stream.rdbuf()) {}
+
+    // Skip whitespace, and return false if there's nothing more to read
+    bool skipWhitespace() {
+        int c;
+        while ((c = _buf.sgetc()) != std::streambuf::traits_type::eof() && isSpace(c)) {
+            _buf.sbumpc();
+        }
+        return c != std::streambuf::traits_type::eof();
+    }
+
+    // The next word, or an empty string at the end of the spec
+    const std::string& word() {
+        skipWhitespace();
+        _word.clear();
+        int c;
+        while ((c = _buf.sgetc()) != std::streambuf::traits_type::eof() && !isSpace(c)) {
+            _word.push_back(char(c));
+            _buf.sbumpc();
+        }
+        return _word;
+    }
+
+    // The rest of the current line, consuming the newline
+    std::string restOfLine() {
+        std::string line;
+        int c;
+        while ((c = _buf.sbumpc()) != std::streambuf::traits_type::eof() && c != '\n') {
+            line.push_back(char(c));
+        }
+        return line;
+    }
+
+    // Skip spaces on the current line, and return true if it ends there
+    bool atEndOfLine() {
+        int c;
+        while ((c = _buf.sgetc()) != '\n' && c != std::streambuf::traits_type::eof() && isSpace(c)) {
+            _buf.sbumpc();
+        }
+        return c == '\n' || c == std::streambuf::traits_type::eof();
+    }
+};
+
 struct GetCutJetsSpec {
     size_t takeNum;
     size_t skipNum;
     bool strict;
     double eventProbabilityMultiplier = NAN;
     long long randomSeed;
+    size_t bootstrapReplicas = 0;
+    std::vector<DerivedVariable> defines;
     std::vector<Cut> cuts;
 
     // Initialize by reading from a specification file (or stdin)
     GetCutJetsSpec(const Format& format, std::string&& str) : GetCutJetsSpec(format, std::istringstream(str)) { }
     GetCutJetsSpec(const Format& format, std::istream&& stream) : GetCutJetsSpec(format, stream) { }
     GetCutJetsSpec(const Format& format, std::istream& stream) {
-        auto nextWord = [&](const std::string& description) {
-            if (stream.eof()) {
-                throw std::runtime_error("Expected " + description + " in spec");
-            }
-            std::string str;
-            stream >> str;
-            if (!stream) {
-                if (str.empty()) {
-                    throw std::runtime_error("Expected " + description + " in spec");
-                } else if (!stream.eof()) {
-                    throw std::runtime_error("Error reading spec; expected " + description);
-                }
+        SpecReader reader(stream);
+        auto nextWord = [&](const char* description, const std::string& varName = "") -> const std::string& {
+            const std::string& word = reader.word();
+            if (word.empty()) {
+                throw std::runtime_error(std::string("Expected ") + description +
+                                         (varName.empty() ? "" : " for " + varName) + " in spec");
             }
-            return str;
+            return word;
         };
         auto consumeWord = [&](const std::string& expected) {
-            std::string actual = nextWord("'" + expected + "'");
-            if (actual != expected) {
+            const std::string& actual = reader.word();
+            if (actual.empty()) {
+                throw std::runtime_error("Expected '" + expected + "' in spec");
+            } else if (actual != expected) {
                 throw std::runtime_error("Expected '" + expected + "' but found " + actual);
             }
         };
         auto spaceSeparatedDoublesToEndOfLine = [&]() {
             std::vector<double> result;
             do {
-                double value;
-                stream >> value;
-                if (!stream) {
+                const std::string& word = reader.word();
+                char* end;
+                double value = std::strtod(word.c_str(), &end);
+                if (word.empty() || *end != '\0') {
                     throw std::runtime_error("Error reading spec; expected doubles");
                 }
                 result.push_back(value);
-            } while (stream.peek() != '\n');
+            } while (!reader.atEndOfLine());
             return result;
         };
 
+        // Look up a variable from the Format or a previous `define:`
+        auto var = [&](const std::string& name) -> size_t {
+            for (const auto& define : defines) {
+                if (define.name == name) {
+                    return define.varIndex;
+                }
+            }
+            return format.var(name);
+        };
+        auto isEventLevel = [&](size_t varIndex) {
+            return varIndex < format.numVars() ? format.isEventLevel(varIndex)
+                                               : defines[varIndex - format.numVars()].eventLevel;
+        };
+
         consumeWord("takeNum:");
         takeNum = std::atoi(nextWord("integer").c_str());
 
@@ -182,47 +437,422 @@ struct GetCutJetsSpec {
         Cut cut;
 
         auto finishCut = [&] {
-            if (!cut.clauses.empty() || !cut.intHistograms.empty() || !cut.binHistograms.empty()) {
-                if (cut.clauses.empty()) {
+            bool hasClauses = !cut.clauses.empty() || cut.scan;
+            bool hasHistograms =
+                !cut.intHistograms.empty() || !cut.binHistograms.empty() || !cut.quantileHistograms.empty();
+            if (hasClauses || hasHistograms) {
+                if (!hasClauses) {
                     throw std::runtime_error("Cut didn't have any clauses");
-                } else if (cut.intHistograms.empty() && cut.binHistograms.empty()) {
+                } else if (!hasHistograms) {
                     throw std::runtime_error("Cut didn't have any histograms");
                 }
-                cuts.push_back(cut);
+                cuts.push_back(std::move(cut));
                 cut = {};
             }
         };
 
         // This looks horrible, but actually it is. Check whether there's any more to read after consuming whitespace.
-        while (stream && stream >> std::ws && stream.peek() != std::istream::traits_type::eof()) {
+        while (reader.skipWhitespace()) {
             std::string directive = nextWord("variable name, new_cut, histogram_ints, or histogram");
             if (directive == "new_cut") {
                 finishCut();
+            } else if (directive == "bootstrapReplicas:") {
+                bootstrapReplicas = std::atoi(nextWord("integer").c_str());
+            } else if (directive == "define:") {
+                std::string name = nextWord("variable name");
+                if (std::find(format.vars.begin(), format.vars.end(), name) != format.vars.end() ||
+                    std::any_of(defines.begin(), defines.end(), [&](const auto& d) { return d.name == name; })) {
+                    throw std::runtime_error("Variable " + name + " is already defined");
+                }
+                consumeWord("=");
+                std::string text = reader.restOfLine();
+                defines.push_back({std::move(name), format.numVars() + defines.size(), Expression(text, var)});
+                const auto& inputs = defines.back().expression.inputs();
+                defines.back().eventLevel = std::all_of(inputs.begin(), inputs.end(), isEventLevel);
+            } else if (directive == "scan:") {
+                if (cut.scan) {
+                    throw std::runtime_error("Cut can only have one scan");
+                }
+                std::string varName = nextWord("variable name");
+                size_t varIndex = var(varName);
+                double lo = std::atof(nextWord("lowest threshold", varName).c_str());
+                double hi = std::atof(nextWord("highest threshold", varName).c_str());
+                size_t steps = std::atoi(nextWord("number of steps", varName).c_str());
+                cut.scan.emplace(varName, varIndex, lo, hi, steps);
             } else if (directive == "histogram_ints:") {
                 std::string varName = nextWord("variable name");
-                size_t varIndex = format.var(varName);
+                size_t varIndex = var(varName);
                 cut.intHistograms.emplace_back(varName, varIndex);
             } else if (directive == "histogram:") {
                 std::string varName = nextWord("variable name");
-                size_t varIndex = format.var(varName);
-                double min = std::atof(nextWord("min value for " + varName).c_str());
-                double max = std::atof(nextWord("max value for " + varName).c_str());
-                size_t numBins = std::atoi(nextWord("number of bins for " + varName).c_str());
+                size_t varIndex = var(varName);
+                double min = std::atof(nextWord("min value", varName).c_str());
+                double max = std::atof(nextWord("max value", varName).c_str());
+                size_t numBins = std::atoi(nextWord("number of bins", varName).c_str());
                 cut.binHistograms.emplace_back(varName, varIndex, min, max, numBins);
             } else if (directive == "histogram_custom:") {
                 std::string varName = nextWord("variable name");
-                size_t varIndex = format.var(varName);
+                size_t varIndex = var(varName);
                 cut.binHistograms.emplace_back(varName, varIndex, spaceSeparatedDoublesToEndOfLine());
+            } else if (directive == "histogram_quantiles:") {
+                std::string varName = nextWord("variable name");
+                size_t varIndex = var(varName);
+                size_t numBins = std::atoi(nextWord("number of bins", varName).c_str());
+                cut.quantileHistograms.emplace_back(varName, varIndex, numBins);
             } else {
-                size_t varIndex = format.var(directive);
-                double min = std::atof(nextWord("min value for " + directive).c_str());
-                double max = std::atof(nextWord("max value for " + directive).c_str());
+                size_t varIndex = var(directive);
+                double min = std::atof(nextWord("min value", directive).c_str());
+                double max = std::atof(nextWord("max value", directive).c_str());
                 cut.clauses.push_back({varIndex, min, max});
             }
         }
 
         finishCut();
+
+        for (auto& cut : cuts) {
+            for (const auto& clause : cut.clauses) {
+                (isEventLevel(clause.varIndex) ? cut.eventClauses : cut.jetClauses).push_back(clause);
+            }
+            if (cut.scan) {
+                CutClause clause{cut.scan->varIndex, cut.scan->thresholds.front(), INFINITY};
+                (isEventLevel(clause.varIndex) ? cut.eventClauses : cut.jetClauses).push_back(clause);
+            }
+            for (auto& hist : cut.intHistograms) {
+                hist.setReplicas(bootstrapReplicas);
+            }
+            for (auto& hist : cut.binHistograms) {
+                hist.setReplicas(bootstrapReplicas);
+            }
+        }
+
+        // Work out which derived variables are needed, directly or through later definitions
+        auto derived = [&](size_t varIndex) -> DerivedVariable* {
+            return varIndex >= format.numVars() ? &defines[varIndex - format.numVars()] : nullptr;
+        };
+        for (const auto& cut : cuts) {
+            for (const auto& clause : cut.eventClauses) {
+                if (auto define = derived(clause.varIndex)) define->neededByEventClauses = true;
+            }
+            for (const auto& clause : cut.jetClauses) {
+                if (auto define = derived(clause.varIndex)) define->neededByClauses = true;
+            }
+            if (cut.scan) {
+                // Each jet taken is binned by the scanned variable, which event clauses alone wouldn't put in the jet
+                if (auto define = derived(cut.scan->varIndex)) define->neededByHistograms = true;
+            }
+            for (const auto& hist : cut.intHistograms) {
+                if (auto define = derived(hist.varIndex)) define->neededByHistograms = true;
+            }
+            for (const auto& hist : cut.binHistograms) {
+                if (auto define = derived(hist.varIndex)) define->neededByHistograms = true;
+            }
+            for (const auto& hist : cut.quantileHistograms) {
+                if (auto define = derived(hist.varIndex)) define->neededByHistograms = true;
+            }
+        }
+        for (auto define = defines.rbegin(); define != defines.rend(); ++define) {
+            for (size_t input : define->expression.inputs()) {
+                if (auto inputDefine = derived(input)) {
+                    inputDefine->neededByEventClauses |= define->neededByEventClauses;
+                    inputDefine->neededByClauses |= define->neededByClauses;
+                    inputDefine->neededByHistograms |= define->neededByHistograms;
+                }
+            }
+        }
+    }
+
+    // Append the derived variables to `values`, which has all the Format's event-level variables, and compute those
+    // needed by event-level clauses (the rest are NaN).
+    void computeDerivedForEventClauses(Jet& values) const {
+        if (defines.empty()) {
+            return;
+        }
+        values.resize(defines.front().varIndex + defines.size(), NAN);
+        for (const auto& define : defines) {
+            if (define.neededByEventClauses) {
+                values[define.varIndex] = define.expression.evaluate(values.data());
+            }
+        }
+    }
+
+    // Append the derived variables to a jet which has all the Format's variables. Only those needed by cut clauses
+    // are computed (the rest are NaN) until computeDerivedForHistograms() is called for a jet that passes a cut.
+    void computeDerivedForClauses(Jet& jet) const {
+        if (defines.empty()) {
+            return;
+        }
+        jet.resize(defines.front().varIndex + defines.size(), NAN);
+        for (const auto& define : defines) {
+            if (define.neededByClauses) {
+                jet[define.varIndex] = define.expression.evaluate(jet.data());
+            }
+        }
+    }
+    void computeDerivedForHistograms(Jet& jet) const {
+        for (const auto& define : defines) {
+            if (define.neededByHistograms && !define.neededByClauses) {
+                jet[define.varIndex] = define.expression.evaluate(jet.data());
+            }
+        }
+    }
+
+    // Normalized spec text which parses back to an equivalent spec. Specs with the same canonical form produce the
+    // same results from the same input.
+    std::string canonical(const Format& format) const {
+        std::ostringstream out;
+        out.precision(17);  // enough to read back exactly
+        out << "takeNum: " << takeNum << "\nskipNum: " << skipNum << "\nstrict: " << (strict ? "true" : "false");
+        out << "\neventProbabilityMultiplier: " << eventProbabilityMultiplier;
+        out << "\nrandomSeed: " << randomSeed << '\n';
+        if (bootstrapReplicas > 0) {
+            out << "bootstrapReplicas: " << bootstrapReplicas << '\n';
+        }
+        auto varName = [&](size_t varIndex) {
+            return varIndex < format.numVars() ? format.vars[varIndex] : defines[varIndex - format.numVars()].name;
+        };
+        for (const auto& define : defines) {
+            out << "define: " << define.name << " = " << define.expression.toString(varName) << '\n';
+        }
+        for (const auto& cut : cuts) {
+            out << "new_cut\n";
+            for (const auto& clause : cut.clauses) {
+                out << varName(clause.varIndex) << ' ' << clause.min << ' ' << clause.max << '\n';
+            }
+            if (cut.scan) {
+                const auto& thresholds = cut.scan->thresholds;
+                out << "scan: " << cut.scan->varName << ' ' << thresholds.front() << ' ' << thresholds.back() << ' '
+                    << thresholds.size() << '\n';
+            }
+            for (const auto& hist : cut.intHistograms) {
+                out << "histogram_ints: " << hist.varName << '\n';
+            }
+            for (const auto& hist : cut.binHistograms) {
+                out << "histogram_custom: " << hist.varName;
+                for (double endpoint : hist.binEndpoints) {
+                    out << ' ' << endpoint;
+                }
+                out << '\n';
+            }
+            for (const auto& hist : cut.quantileHistograms) {
+                out << "histogram_quantiles: " << hist.varName << ' ' << hist.numBins << '\n';
+            }
+        }
+        return out.str();
+    }
+};
+
+// Accumulates a CutJetsResult from events fed to it one at a time, applying the spec's event sampling and
+// skipNum/takeNum/strict jet selection. Events are described in the order they appear in an input file:
+// beginEvent(), then the optional gluon flags and Z data, then wantJet()/addJet() for each jet line.
+class CutJetsProcessor {
+    const Format& _format;
+    const GetCutJetsSpec& _spec;
+    const bool _useEventProbability;
+    const CpuKernels& _kernels;
+    std::uniform_real_distribution<double> _randDouble{0.0, 1.0};
+    std::mt19937_64 _randEngine;
+    double _crossSection = NAN;  // keep this across events so we can return the last value
+    CutJetsResult _result;
+    HistogramArena _arena;  // accumulators of each cut's binHistograms, which are copied into _result by finish()
+    JetDumpWriter* _jetDump = nullptr;
+
+    // State of the current event
+    uint64_t _eventIndex = 0;  // position in the input of the event after the current one
+    std::vector<double> _replicaWeights;
+    bool _keepEvent = false;
+    double _weight = 0;
+    int _isGluon1 = 2;
+    int _isGluon2 = 2;
+    double _zData[5];
+    size_t _jetsSeen = 0;
+    // Jets taken by each cut, with cuts ruled out by their event clauses counted as having taken takeNum. Only the
+    // cuts in _touchedCuts can be nonzero, so resetting doesn't go through every cut; _openCuts counts those below
+    // takeNum, so that finding that every cut is satisfied doesn't either.
+    std::vector<size_t> _jetsTaken;
+    std::vector<size_t> _touchedCuts;
+    size_t _openCuts = 0;
+    bool _hasEventClauses = false;
+    bool _eventClausesChecked = false;
+    Jet _eventValues;  // event-level variables of the current event (the rest are NaN) for checking event clauses
+
+    // When staging, the current event's histogram fills are held back until the next event begins, and the
+    // event-level totals as of the start of the current event are kept, so that saveState() can describe the input
+    // up to the start of the current event.
+    struct StagedFill {
+        size_t cutIndex;
+        size_t jetIndex;
+    };
+    bool _staging = false;
+    std::vector<Jet> _stagedJets;
+    std::vector<StagedFill> _stagedFills;
+    uint64_t _committedEventIndex = 0;
+    size_t _committedNumEvents = 0;
+    double _committedTotalWeight = 0;
+    double _committedCrossSection = NAN;
+    std::mt19937_64 _committedRandEngine;
+
+    double jetWeight() const {
+        return _useEventProbability ? 1.0 : _weight;
+    }
+
+    void setJetsTaken(size_t cutIndex, size_t jetsTaken) {
+        if (_jetsTaken[cutIndex] == 0) {
+            _touchedCuts.push_back(cutIndex);
+        }
+        if (_jetsTaken[cutIndex] < _spec.takeNum && jetsTaken >= _spec.takeNum) {
+            --_openCuts;
+        }
+        _jetsTaken[cutIndex] = jetsTaken;
+    }
+
+    void checkEventClauses();
+    bool evaluateJet(Jet& jet);
+    void fill(size_t cutIndex, const Jet& jet);
+    void commitStaged();
+
+public:
+    CutJetsProcessor(const Format& format, const GetCutJetsSpec& spec);
+
+    // Start event `eventIndex` of the input, counting from 0 and including events dropped by sampling. The position
+    // determines the event's bootstrap replica weights, so they don't depend on the order events are fed in. Returns
+    // false if the event was dropped by eventProbabilityMultiplier sampling.
+    bool beginEvent(uint64_t eventIndex, double weight, double crossSection);
+
+    // Position of the event after the last one begun or skipped over (or the one to resume from after loadState())
+    uint64_t nextEventIndex() const {
+        return _eventIndex;
+    }
+
+    // Data which get inserted into each jet in the current event
+    void setGluonFlags(int isGluon1, int isGluon2) {
+        _isGluon1 = isGluon1;
+        _isGluon2 = isGluon2;
+    }
+    void setZData(const double (&zData)[5]) {
+        std::copy(std::begin(zData), std::end(zData), std::begin(_zData));
+    }
+
+    // Call once for each jet line in the current event. Returns true if the jet should be read and passed to
+    // addJet(), or false if it can be skipped without parsing.
+    bool wantJet();
+
+    // Add a jet as it appears in the input (without the weight, Z data, and gluon flags inserted). The event data
+    // and derived variables are inserted into `jet` in place. A jet passed as an lvalue is left with the caller (and
+    // copied only if events are staged), so one buffer can be reused for every jet without allocating.
+    void addJet(Jet&& jet);
+    void addJet(Jet& jet);
+
+    // Jump ahead to event `eventIndex` of the input as if the events in between had been read and none of their jets
+    // passed any cut. `totalWeight` is the sum of the weights of all events before `eventIndex`, and `crossSection` is
+    // the last one's. Every event has to be read when sampling or staging, so neither may be in use.
+    void skipTo(uint64_t eventIndex, double totalWeight, double crossSection);
+
+    // Also record each accepted jet in `jetDump`
+    void dumpJets(JetDumpWriter& jetDump) {
+        _jetDump = &jetDump;
+    }
+
+    // Hold back each event's histogram fills until the next event begins. Must be enabled before the first event in
+    // order to use saveState(); used for checkpointing, since the last event in a growing file may be incomplete.
+    void stageEvents();
+
+    // Save the accumulated state as of the start of the current event, or restore it before the first event.
+    void saveState(std::ostream& out) const;
+    void loadState(std::istream& in);
+
+    // Cross section of the last event kept so far (NaN before the first)
+    double crossSection() const {
+        return _crossSection;
     }
+
+    // Normalize the histograms and return the result. The processor should not be used afterward.
+    CutJetsResult finish();
+
+    // Like finish(), but leave the histograms un-normalized so that they can be saved and finished later
+    CutJetsResult finishAccumulators();
+
+    // A copy of the un-normalized result so far (without any staged fills), leaving the processor usable
+    CutJetsResult accumulators() const;
+};
+
+// Feed the events in `filename` to `processor`
+void readEvents(const Format& format, const char* filename, CutJetsProcessor& processor);
+
+// If `jetDump` is given, each accepted jet is also recorded there.
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         JetDumpWriter* jetDump = nullptr);
+
+// Like getCutJets, but skip the blocks of the input in which `zoneMap` shows that no jet can pass any cut. The zone
+// map isn't used when sampling with eventProbabilityMultiplier, which has to see every event.
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         const ZoneMap& zoneMap);
+
+// Time spent by each stage of the pipelined getCutJets, to show which stage bounds the throughput
+struct PipelineStageStats {
+    const char* name;
+    double busySeconds = 0;
+    double inputWaitSeconds = 0;  // starved, waiting for the previous stage
+    double outputWaitSeconds = 0;  // blocked by backpressure, waiting for the next stage to free a buffer
+};
+
+struct PipelineStats {
+    double wallSeconds = 0;
+    std::vector<PipelineStageStats> stages;
+};
+
+// Like getCutJets, but with reading, parsing, and cut evaluation running on separate threads, connected by bounded
+// rings of buffers. The input is read sequentially (so it can be a pipe) and events reach the processor in order, so
+// the result is identical; but every jet line is parsed, so a malformed one is an error even if no cut needs it.
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         PipelineStats& stats);
+
+// Like getCutJets, but resume from the checkpoint at `checkpointPath` if it exists, and write checkpoints there
+// periodically and on completion. A checkpoint records the input offset of the last event that may still be
+// incomplete, so events appended to the input since the previous run are picked up.
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         const std::string& checkpointPath);
+
+// Results of one job over several inputs, such as the pT-hat bins of one physics sample
+struct MultiSampleResult {
+    static const size_t DEFAULT_CHUNK_BYTES = size_t(8) << 20;
+
+    std::vector<std::string> inputs;
+    std::vector<CutJetsResult> samples;  // each as if its input had been run on its own
+    // Every sample's un-normalized histograms weighted by its csOnW, added up and then normalized. The weights are
+    // then in units of cross section, so totalWeight is the sum of the samples' cross sections and csOnW is 1.
+    CutJetsResult combined;
+
+    size_t numTasks = 0;  // chunks (or whole inputs) that were scheduled
+    size_t steals = 0;  // tasks run by a thread other than the one they were queued on
+};
+
+// Run `spec` over each of `inputs` on a pool of `numThreads` threads (0 for one per core) with work stealing. Inputs
+// are split at event boundaries into chunks of about `chunkBytes`, so that one big input doesn't leave the other
+// threads idle at the end; the chunks' sums are added in a different order than a single pass would, so may differ by
+// rounding, and the approximate bin endpoints of quantile histograms may move slightly. Sampling and bootstrap
+// replicas need each input's events in order, so with either one each input is a single task, and sample i is run
+// with randomSeed + i so that the samples are independent.
+MultiSampleResult getCutJets(const Format& format, const std::vector<std::string>& inputs,
+                             const GetCutJetsSpec& spec, size_t numThreads = 0,
+                             size_t chunkBytes = MultiSampleResult::DEFAULT_CHUNK_BYTES);
+
+struct ProgressiveOptions {
+    static const size_t DEFAULT_BLOCK_BYTES = size_t(1) << 20;
+
+    // Stop once no nonempty bin of a watched histogram has a relative error (binErrs / binSums) above this. A watched
+    // histogram without any nonempty bins hasn't converged.
+    double targetRelativeError = 0;
+    std::vector<std::string> variables;  // watch the histograms of these variables in every cut; empty for all
+    size_t blockBytes = DEFAULT_BLOCK_BYTES;
+    size_t blocksPerUpdate = 0;  // blocks read between checks of the errors; 0 for about 2% of the input
+    std::function<void(const CutJetsResult& interim, const ProgressiveStatus& status)> onUpdate;  // at each check
 };
 
-CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec);
+// Like getCutJets, but read the input's blocks (split at event boundaries) in an order shuffled with randomSeed, and
+// stop early once the watched histograms reach options.targetRelativeError. The interim results are normalized by the
+// weight read so far, and their csOnW uses the cross section of the last event of the furthest block read, so they
+// estimate the full result. Each event keeps its position in the input, so with bootstrap replicas a run that reads
+// every block gives the same replicas as getCutJets. `status` describes the point at which reading stopped. Scan
+// results aren't watched.
+CutJetsResult getCutJets(const Format& format, const char* filename, const GetCutJetsSpec& spec,
+                         const ProgressiveOptions& options, ProgressiveStatus& status);
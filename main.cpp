@@ -1,10 +1,17 @@
-#include <cinttypes>
-#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include "CpuDispatch.h"
+#include "ResultCache.h"
+#include "ZoneMap.h"
 #include "get_cuts.h"
+#include "output.h"
+#include "server.h"
 #include "test.h"
 
 static Format NewerFormat({
@@ -17,27 +24,70 @@ static Format NewFormat({
 
 int main(int argc, char** argv) {
     std::vector<std::string> args(argv+1, argv+argc);
+    OutputFormat outputFormat = OutputFormat::YAML;
+    for (auto it = args.begin(); it != args.end(); it++) {
+        if (*it == "--format" && it + 1 != args.end()) {
+            outputFormat = parseOutputFormat(*(it + 1));
+            args.erase(it, it + 2);
+            break;
+        }
+    }
     if (args.size() > 0 && args[0] == "--test") {
         runTests();
         return 0;
     }
 
-    if (args.size() != 2) {
+    if (args.size() == 1 && args[0] == "--cpu-features") {
+        std::cout << cpuFeatureReport();
+        return 0;
+    }
+
+    if (args.size() >= 2 && args.size() <= 3 && args[0] == "--query") {
+        return runQuery(args[1], args.size() == 3 ? args[2] : "", std::cin);
+    }
+
+    bool serve = args.size() >= 4 && args[1] == "--serve";
+    bool samples = args.size() >= 3 && args[1] == "--samples";
+    bool checkpoint = args.size() == 4 && args[2] == "--checkpoint";
+    bool dumpJets = args.size() == 4 && args[2] == "--dump-jets";
+    bool cache = args.size() == 4 && args[2] == "--cache";
+    bool buildZones = args.size() == 4 && args[2] == "--build-zone-map";
+    bool useZones = args.size() == 4 && args[2] == "--zone-map";
+    bool pipeline = args.size() == 3 && args[2] == "--pipeline";
+    bool progressive = (args.size() == 4 || (args.size() == 6 && args[4] == "--watch")) && args[2] == "--target-error";
+    if (args.size() != 2 && !serve && !samples && !checkpoint && !dumpJets && !cache && !buildZones && !useZones &&
+        !pipeline && !progressive) {
         std::cerr << std::string(R"(
-Usage: get_cuts [--new|--newer] input.txt < spec.txt
+Usage: get_cuts [--new|--newer] input.txt [--checkpoint state.txt | --dump-jets jets.bin | --cache dir |
+                                            --zone-map zones.txt | --pipeline] [--format yaml|json|binary] < spec.txt
+       get_cuts [--new|--newer] input.txt --target-error 0.05 [--watch VAR_1,VAR_2] [--format ...] < spec.txt
+       get_cuts [--new|--newer] input.txt --build-zone-map zones.txt
+       get_cuts [--new|--newer] --samples input1.txt input2.txt ... [--format yaml|json|binary] < spec.txt
+       get_cuts [--new|--newer] --serve socket input.txt [input2.txt ...]
+       get_cuts --query socket [input.txt] < spec.txt
+       get_cuts --cpu-features
+Set GET_CUTS_CPU to scalar, sse4.2, avx2, or avx512 to force a kernel variant.
+--format json writes every number exactly; --format binary is described in output.h.
+--target-error reads the input's blocks in random order until every nonempty bin of the histograms of the
+watched variables (all by default) has a relative error below the target. The result's "progressive" field
+reports how much was read.
 Spec file format:
   takeNum: 2
   skipNum: 2
   strict: true
   eventProbabilityMultiplier: nan
   randomSeed: 0
+  bootstrapReplicas: 20
+  define: VAR_5 = VAR_1 / hypot(VAR_2, VAR_3)
 
   new_cut
   VAR_1 min1 max1
   VAR_2 min2 max2
+  scan: VAR_PT 20 100 81
   histogram_ints: VAR_3
   histogram: VAR_4 0.2 0.5 20
   histogram_custom: VAR_4 0.10 0.15 0.20 0.25 0.30
+  histogram_quantiles: VAR_5 10
 
   new_cut
   VAR_1 min1 max1
@@ -60,63 +110,91 @@ Spec file format:
         }
     }
 
+    if (serve) {
+        runServer(*format, args[2], std::vector<std::string>(args.begin() + 3, args.end()));
+        return 0;
+    }
+
+    if (samples) {
+        // Each input's results, and their combination weighted by each one's cs_on_w
+        GetCutJetsSpec spec(*format, std::cin);
+        MultiSampleResult result = getCutJets(*format, std::vector<std::string>(args.begin() + 2, args.end()), spec);
+        std::fprintf(stderr, "Read %zu inputs in %zu tasks (%zu stolen)\n",
+            result.inputs.size(), result.numTasks, result.steals);
+        writeResult(stdout, result, outputFormat);
+        return 0;
+    }
+
     const auto& filename = args[1];
 
+    if (buildZones) {
+        buildZoneMap(*format, filename.c_str()).save(args[3]);
+        return 0;
+    }
+
     GetCutJetsSpec spec(*format, std::cin);
-    CutJetsResult result = getCutJets(*format, filename.c_str(), spec);
-
-    std::printf("num_events: %zu\n", result.numEvents);
-    std::printf("total_weight: %lg\n", result.totalWeight);
-    std::printf("cs_on_w: %lg\n", result.csOnW);
-    std::printf("cuts:\n");
-    for (const auto& cutResult : result.cutResults) {
-        std::printf("  -\n");
-        std::printf("    total_jets_taken: %zu\n", cutResult.totalJetsTaken);
-        std::printf("    histograms:\n");
-        for (const auto& hist : cutResult.intHistograms) {
-            std::printf("      %s:\n", hist.varName.c_str());
-            std::printf("        total_weight: %lg\n", hist.totalWeight);
-            std::printf("        total_err: %lg\n", hist.totalErr);
-
-            std::printf("        bins: [");
-            for (const auto& [k, v] : hist.binSums) std::printf("%" PRIdMAX ", ", k);
-            std::printf("]\n");
-            std::printf("        values: [");
-            for (const auto& [k, v] : hist.binSums) std::printf("%lg, ", v);
-            std::printf("]\n");
-            std::printf("        errs: [");
-            for (const auto& [k, v] : hist.binSums) std::printf("%lg, ", hist.binErrs.at(k));
-            std::printf("]\n");
+    CutJetsResult result;
+    if (checkpoint) {
+        result = getCutJets(*format, filename.c_str(), spec, args[3]);
+    } else if (dumpJets) {
+        // Accepted jets with their weights and event ordinals, in the binary columnar format described in JetDump.h
+        JetDumpWriter jetDump(args[3], *format, spec.cuts.size());
+        result = getCutJets(*format, filename.c_str(), spec, &jetDump);
+        jetDump.close();
+    } else if (cache) {
+        ResultCache resultCache(args[3], filename.c_str());
+        if (auto output = resultCache.loadOutput(*format, spec, outputFormat)) {
+            std::fwrite(output->data(), 1, output->size(), stdout);
+            std::fprintf(stderr, "Reused cached output\n");
+            return 0;
+        }
+        result = resultCache.getCutJets(*format, filename.c_str(), spec);
+        std::fprintf(stderr, "Reused %zu and computed %zu cached pieces\n",
+            resultCache.piecesReused(), resultCache.piecesComputed());
+        std::string output = resultString(result, outputFormat);
+        resultCache.storeOutput(*format, spec, output, outputFormat);
+        std::fwrite(output.data(), 1, output.size(), stdout);
+        return 0;
+    } else if (useZones) {
+        ZoneMap zoneMap = ZoneMap::load(args[3]);
+        if (std::isnan(spec.eventProbabilityMultiplier)) {
+            auto toRead = zoneMap.blocksToRead(spec);
+            std::fprintf(stderr, "Reading %zu of %zu blocks\n",
+                size_t(std::count(toRead.begin(), toRead.end(), true)), toRead.size());
+        }
+        result = getCutJets(*format, filename.c_str(), spec, zoneMap);
+    } else if (pipeline) {
+        PipelineStats stats;
+        result = getCutJets(*format, filename.c_str(), spec, stats);
+        std::fprintf(stderr, "%-10s %8s %8s %8s\n", "stage", "busy", "starved", "blocked");
+        for (const auto& stage : stats.stages) {
+            std::fprintf(stderr, "%-10s %7.1f%% %7.1f%% %7.1f%%\n", stage.name,
+                100 * stage.busySeconds / stats.wallSeconds, 100 * stage.inputWaitSeconds / stats.wallSeconds,
+                100 * stage.outputWaitSeconds / stats.wallSeconds);
         }
-        for (const auto& hist : cutResult.binHistograms) {
-            std::printf("      %s:\n", hist.varName.c_str());
-            std::printf("        total_weight: %lg\n", hist.totalWeight);
-            std::printf("        total_err: %lg\n", hist.totalErr);
-
-            std::printf("        bins: [");
-            for (const auto& val : hist.binEndpoints) std::printf("%lg, ", val);
-            std::printf("]\n");
-            std::printf("        values: [");
-            for (const auto& val : hist.binSums) std::printf("%lg, ", val);
-            std::printf("]\n");
-            std::printf("        errs: [");
-            for (const auto& val : hist.binErrs) std::printf("%lg, ", val);
-            std::printf("]\n");
+    } else if (progressive) {
+        ProgressiveOptions options;
+        options.targetRelativeError = std::stod(args[3]);
+        if (args.size() == 6) {
+            std::istringstream variables(args[5]);
+            for (std::string varName; std::getline(variables, varName, ',');) {
+                options.variables.push_back(varName);
+            }
         }
+        options.onUpdate = [](const CutJetsResult&, const ProgressiveStatus& status) {
+            std::fprintf(stderr, "Read %5.1f%% of the input: largest relative error %.3g\n",
+                100 * status.fractionRead, status.maxRelativeError);
+        };
+        ProgressiveStatus status;
+        result = getCutJets(*format, filename.c_str(), spec, options, status);
+        std::fprintf(stderr, "Stopped after reading %.1f%% of the input (%zu of %zu blocks) with largest relative "
+            "error %.3g (target %.3g)\n", 100 * status.fractionRead, status.blocksRead, status.numBlocks,
+            status.maxRelativeError, options.targetRelativeError);
+    } else {
+        result = getCutJets(*format, filename.c_str(), spec);
     }
 
-    // Naive output as CSV
-    // std::printf("%lf\n", result.csOnW);
-    // for (size_t i = 0; i < result.jetsList.size(); i++) {
-    //     // std::printf("# Cut %zu: %zu jets taken\n", i, result.jetsList[i].size());
-    //     for (const auto& jet : result.jetsList[i]) {
-    //         for (double val : jet) {
-    //             std::printf("%lg,", val);
-    //         }
-    //         std::printf("\n");
-    //     }
-    //     std::printf("\n\n");
-    // }
+    writeResult(stdout, result, outputFormat);
 
     return 0;
 }
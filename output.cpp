@@ -0,0 +1,607 @@
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "output.h"
+
+static const char MAGIC[8] = {'G', 'C', 'R', 'S', 'L', 'T', '2', '\0'};
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+enum HistogramKind : uint32_t { INTS, BINNED, QUANTILES };
+
+static size_t padTo8(size_t size) {
+    return (size + 7) / 8 * 8;
+}
+
+static std::string padded(std::string str) {
+    str.resize(padTo8(str.size()), '\0');
+    return str;
+}
+
+// Collects output in a large buffer, which is written to a file or appended to a string whenever it fills up
+class BufferedWriter {
+    static const size_t BUFFER_SIZE = size_t(1) << 20;
+    static const size_t MAX_NUMBER_SIZE = 32;
+
+    std::FILE* _file = nullptr;
+    std::string* _string = nullptr;
+    std::unique_ptr<char[]> _buf{new char[BUFFER_SIZE]};
+    size_t _size = 0;
+
+    char* reserve(size_t size) {
+        if (BUFFER_SIZE - _size < size) {
+            flush();
+        }
+        return _buf.get() + _size;
+    }
+
+public:
+    explicit BufferedWriter(std::FILE* file) : _file(file) {}
+    explicit BufferedWriter(std::string& str) : _string(&str) {}
+
+    void flush() {
+        if (_file) {
+            if (std::fwrite(_buf.get(), 1, _size, _file) != _size) {
+                throw std::system_error(errno, std::system_category(), "Error writing output");
+            }
+        } else {
+            _string->append(_buf.get(), _size);
+        }
+        _size = 0;
+    }
+
+    void write(const void* data, size_t size) {
+        auto bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            size_t chunk = std::min(size, BUFFER_SIZE);
+            std::memcpy(reserve(chunk), bytes, chunk);
+            _size += chunk;
+            bytes += chunk;
+            size -= chunk;
+        }
+    }
+
+    BufferedWriter& operator<<(const char* str) {
+        write(str, std::strlen(str));
+        return *this;
+    }
+    BufferedWriter& operator<<(const std::string& str) {
+        write(str.data(), str.size());
+        return *this;
+    }
+    BufferedWriter& operator<<(char c) {
+        *reserve(1) = c;
+        _size++;
+        return *this;
+    }
+
+    // Formatted like printf's %lg
+    void general(double value) {
+        char* start = reserve(MAX_NUMBER_SIZE);
+        _size = std::to_chars(start, start + MAX_NUMBER_SIZE, value, std::chars_format::general, 6).ptr - _buf.get();
+    }
+
+    // The shortest text that reads back as exactly `value`
+    void exact(double value) {
+        char* start = reserve(MAX_NUMBER_SIZE);
+        _size = std::to_chars(start, start + MAX_NUMBER_SIZE, value).ptr - _buf.get();
+    }
+
+    template<typename Int>
+    void integer(Int value) {
+        char* start = reserve(MAX_NUMBER_SIZE);
+        _size = std::to_chars(start, start + MAX_NUMBER_SIZE, value).ptr - _buf.get();
+    }
+
+    // Raw bytes of a value or array, for the binary format
+    template<typename T>
+    void raw(const T& value) {
+        write(&value, sizeof(value));
+    }
+    template<typename T>
+    void raw(const std::vector<T>& values) {
+        write(values.data(), values.size() * sizeof(T));
+    }
+};
+
+
+// The total and histograms of a cut, or of one threshold of a scan, with each line starting with `indent`
+static void writeYAMLCut(BufferedWriter& out, const CutResult& cutResult, const std::string& indent) {
+    auto list = [&](const char* name, const auto& values, auto&& write) {
+        out << indent << "    " << name << ": [";
+        for (const auto& value : values) {
+            write(value);
+            out << ", ";
+        }
+        out << "]\n";
+    };
+    auto header = [&](const auto& hist) {
+        out << indent << "  " << hist.varName << ":\n";
+        out << indent << "    total_weight: ";
+        out.general(hist.totalWeight);
+        out << '\n' << indent << "    total_err: ";
+        out.general(hist.totalErr);
+        out << "\n";
+    };
+    auto general = [&](double value) { out.general(value); };
+
+    out << indent << "total_jets_taken: ";
+    out.integer(cutResult.totalJetsTaken);
+    out << '\n' << indent << "histograms:\n";
+    for (const auto& hist : cutResult.intHistograms) {
+        header(hist);
+        list("bins", hist.binSums, [&](const auto& bin) { out.integer(bin.first); });
+        list("values", hist.binSums, [&](const auto& bin) { out.general(bin.second); });
+        list("errs", hist.binSums, [&](const auto& bin) { out.general(hist.binErrs.at(bin.first)); });
+        if (hist.numReplicas > 0) {
+            list("replica_errs", hist.binSums, [&](const auto& bin) { out.general(hist.binReplicaErrs.at(bin.first)); });
+        }
+    }
+    auto printBinned = [&](const auto& hist, const std::vector<double>& replicaErrs) {
+        header(hist);
+        list("bins", hist.binEndpoints, general);
+        list("values", hist.binSums, general);
+        list("errs", hist.binErrs, general);
+        if (!replicaErrs.empty()) {
+            list("replica_errs", replicaErrs, general);
+        }
+    };
+    for (const auto& hist : cutResult.binHistograms) printBinned(hist, hist.binReplicaErrs);
+    for (const auto& hist : cutResult.quantileHistograms) printBinned(hist, {});
+}
+
+// With each line starting with `indent`, so that results can be nested
+static void writeYAML(BufferedWriter& out, const CutJetsResult& result, const std::string& indent = "") {
+    out << indent << "num_events: ";
+    out.integer(result.numEvents);
+    out << '\n' << indent << "total_weight: ";
+    out.general(result.totalWeight);
+    out << '\n' << indent << "cs_on_w: ";
+    out.general(result.csOnW);
+    if (result.progressive) {
+        out << '\n' << indent << "progressive:\n" << indent << "  fraction_read: ";
+        out.general(result.progressive->fractionRead);
+        out << '\n' << indent << "  blocks_read: ";
+        out.integer(result.progressive->blocksRead);
+        out << '\n' << indent << "  num_blocks: ";
+        out.integer(result.progressive->numBlocks);
+        out << '\n' << indent << "  max_relative_error: ";
+        out.general(result.progressive->maxRelativeError);
+    }
+    out << '\n' << indent << "cuts:\n";
+    for (const auto& cutResult : result.cutResults) {
+        out << indent << "  -\n";
+        writeYAMLCut(out, cutResult, indent + "    ");
+        if (cutResult.scan) {
+            out << indent << "    scan:\n" << indent << "      variable: " << cutResult.scan->varName << '\n';
+            out << indent << "      thresholds:\n";
+            for (size_t i = 0; i < cutResult.scanResults.size(); i++) {
+                out << indent << "        -\n" << indent << "          threshold: ";
+                out.general(cutResult.scan->thresholds[i]);
+                out << '\n' << indent << "          total_weight: ";
+                out.general(cutResult.scanWeights[i]);
+                out << '\n';
+                writeYAMLCut(out, cutResult.scanResults[i], indent + "          ");
+            }
+        }
+    }
+}
+
+static void writeYAML(BufferedWriter& out, const MultiSampleResult& result) {
+    out << "samples:\n";
+    for (size_t i = 0; i < result.samples.size(); i++) {
+        out << "  -\n    input: " << result.inputs[i] << '\n';
+        writeYAML(out, result.samples[i], "    ");
+    }
+    out << "combined:\n";
+    writeYAML(out, result.combined, "  ");
+}
+
+
+static void writeJSONNumber(BufferedWriter& out, double value) {
+    if (std::isfinite(value)) {
+        out.exact(value);
+    } else {
+        out << "null";
+    }
+}
+
+static void writeJSONString(BufferedWriter& out, const std::string& str) {
+    out << '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+    out << '"';
+}
+
+template<typename Values, typename Fn>
+static void writeJSONList(BufferedWriter& out, const char* name, const Values& values, Fn&& write) {
+    out << ",\"" << name << "\":[";
+    bool first = true;
+    for (const auto& value : values) {
+        if (!first) {
+            out << ',';
+        }
+        first = false;
+        write(value);
+    }
+    out << ']';
+}
+
+static void writeJSONCut(BufferedWriter& out, const CutResult& cutResult) {
+    auto number = [&](double value) { writeJSONNumber(out, value); };
+    auto header = [&](const auto& hist, const char* kind) {
+        out << "{\"variable\":";
+        writeJSONString(out, hist.varName);
+        out << ",\"kind\":\"" << kind << "\",\"total_weight\":";
+        writeJSONNumber(out, hist.totalWeight);
+        out << ",\"total_err\":";
+        writeJSONNumber(out, hist.totalErr);
+    };
+
+    out << "\"total_jets_taken\":";
+    out.integer(cutResult.totalJetsTaken);
+    out << ",\"histograms\":[";
+    bool first = true;
+    for (const auto& hist : cutResult.intHistograms) {
+        out << (first ? "" : ",");
+        first = false;
+        header(hist, "ints");
+        writeJSONList(out, "bins", hist.binSums, [&](const auto& bin) { out.integer(bin.first); });
+        writeJSONList(out, "values", hist.binSums, [&](const auto& bin) { number(bin.second); });
+        writeJSONList(out, "errs", hist.binSums, [&](const auto& bin) { number(hist.binErrs.at(bin.first)); });
+        if (hist.numReplicas > 0) {
+            writeJSONList(out, "replica_errs", hist.binSums,
+                          [&](const auto& bin) { number(hist.binReplicaErrs.at(bin.first)); });
+        }
+        out << '}';
+    }
+    auto writeBinned = [&](const auto& hist, const char* kind, const std::vector<double>& replicaErrs) {
+        out << (first ? "" : ",");
+        first = false;
+        header(hist, kind);
+        writeJSONList(out, "bins", hist.binEndpoints, number);
+        writeJSONList(out, "values", hist.binSums, number);
+        writeJSONList(out, "errs", hist.binErrs, number);
+        if (!replicaErrs.empty()) {
+            writeJSONList(out, "replica_errs", replicaErrs, number);
+        }
+        out << '}';
+    };
+    for (const auto& hist : cutResult.binHistograms) writeBinned(hist, "binned", hist.binReplicaErrs);
+    for (const auto& hist : cutResult.quantileHistograms) writeBinned(hist, "quantiles", {});
+    out << ']';
+}
+
+// The members of a result's object, without the braces
+static void writeJSONMembers(BufferedWriter& out, const CutJetsResult& result) {
+    out << "\"num_events\":";
+    out.integer(result.numEvents);
+    out << ",\"total_weight\":";
+    writeJSONNumber(out, result.totalWeight);
+    out << ",\"cs_on_w\":";
+    writeJSONNumber(out, result.csOnW);
+    if (result.progressive) {
+        out << ",\"progressive\":{\"fraction_read\":";
+        writeJSONNumber(out, result.progressive->fractionRead);
+        out << ",\"blocks_read\":";
+        out.integer(result.progressive->blocksRead);
+        out << ",\"num_blocks\":";
+        out.integer(result.progressive->numBlocks);
+        out << ",\"max_relative_error\":";
+        writeJSONNumber(out, result.progressive->maxRelativeError);
+        out << '}';
+    }
+    out << ",\"cuts\":[";
+    for (size_t c = 0; c < result.cutResults.size(); c++) {
+        const auto& cutResult = result.cutResults[c];
+        out << (c == 0 ? "{" : ",{");
+        writeJSONCut(out, cutResult);
+        if (cutResult.scan) {
+            out << ",\"scan\":{\"variable\":";
+            writeJSONString(out, cutResult.scan->varName);
+            out << ",\"thresholds\":[";
+            for (size_t i = 0; i < cutResult.scanResults.size(); i++) {
+                out << (i == 0 ? "{" : ",{") << "\"threshold\":";
+                writeJSONNumber(out, cutResult.scan->thresholds[i]);
+                out << ",\"total_weight\":";
+                writeJSONNumber(out, cutResult.scanWeights[i]);
+                out << ',';
+                writeJSONCut(out, cutResult.scanResults[i]);
+                out << '}';
+            }
+            out << "]}";
+        }
+        out << '}';
+    }
+    out << ']';
+}
+
+static void writeJSON(BufferedWriter& out, const CutJetsResult& result) {
+    out << '{';
+    writeJSONMembers(out, result);
+    out << "}\n";
+}
+
+static void writeJSON(BufferedWriter& out, const MultiSampleResult& result) {
+    out << "{\"samples\":[";
+    for (size_t i = 0; i < result.samples.size(); i++) {
+        out << (i == 0 ? "{" : ",{") << "\"input\":";
+        writeJSONString(out, result.inputs[i]);
+        out << ',';
+        writeJSONMembers(out, result.samples[i]);
+        out << '}';
+    }
+    out << "],\"combined\":{";
+    writeJSONMembers(out, result.combined);
+    out << "}}\n";
+}
+
+
+static void writeBinaryCut(BufferedWriter& out, const CutResult& cutResult) {
+    out.raw(uint64_t(cutResult.totalJetsTaken));
+    out.raw(uint64_t(cutResult.intHistograms.size() + cutResult.binHistograms.size() +
+                     cutResult.quantileHistograms.size()));
+    auto header = [&](const auto& hist, HistogramKind kind, size_t numBins, size_t numReplicas) {
+        uint32_t sizes[] = {kind, uint32_t(hist.varName.size())};
+        out.raw(sizes);
+        out << padded(hist.varName);
+        uint64_t counts[] = {numBins, numReplicas};
+        out.raw(counts);
+        double totals[] = {hist.totalWeight, hist.totalErr};
+        out.raw(totals);
+    };
+    for (const auto& hist : cutResult.intHistograms) {
+        header(hist, INTS, hist.binSums.size(), hist.numReplicas);
+        for (const auto& [k, v] : hist.binSums) out.raw(int64_t(k));
+        for (const auto& [k, v] : hist.binSums) out.raw(v);
+        for (const auto& [k, v] : hist.binSums) out.raw(hist.binErrs.at(k));
+        if (hist.numReplicas > 0) {
+            for (const auto& [k, v] : hist.binSums) out.raw(hist.binReplicaErrs.at(k));
+        }
+    }
+    for (const auto& hist : cutResult.binHistograms) {
+        header(hist, BINNED, hist.binSums.size(), hist.numReplicas);
+        out.raw(hist.binEndpoints);
+        out.raw(hist.binSums);
+        out.raw(hist.binErrs);
+        out.raw(hist.binReplicaErrs);
+    }
+    for (const auto& hist : cutResult.quantileHistograms) {
+        header(hist, QUANTILES, hist.binSums.size(), 0);
+        out.raw(hist.binEndpoints);
+        out.raw(hist.binSums);
+        out.raw(hist.binErrs);
+    }
+}
+
+static void writeBinary(BufferedWriter& out, const CutJetsResult& result) {
+    out.raw(MAGIC);
+    uint32_t header[] = {BYTE_ORDER_MARK, uint32_t(result.cutResults.size())};
+    out.raw(header);
+    out.raw(uint64_t(result.numEvents));
+    double totals[] = {result.totalWeight, result.csOnW};
+    out.raw(totals);
+    out.raw(uint64_t(result.progressive.has_value()));
+    if (result.progressive) {
+        uint64_t blocks[] = {uint64_t(result.progressive->blocksRead), uint64_t(result.progressive->numBlocks)};
+        out.raw(blocks);
+        double progress[] = {result.progressive->fractionRead, result.progressive->maxRelativeError};
+        out.raw(progress);
+    }
+    for (const auto& cutResult : result.cutResults) {
+        writeBinaryCut(out, cutResult);
+        out.raw(uint64_t(cutResult.scanResults.size()));
+        if (cutResult.scan) {
+            out.raw(uint64_t(cutResult.scan->varName.size()));
+            out << padded(cutResult.scan->varName);
+        }
+        for (size_t i = 0; i < cutResult.scanResults.size(); i++) {
+            double scanTotals[] = {cutResult.scan->thresholds[i], cutResult.scanWeights[i]};
+            out.raw(scanTotals);
+            writeBinaryCut(out, cutResult.scanResults[i]);
+        }
+    }
+}
+
+
+OutputFormat parseOutputFormat(const std::string& name) {
+    if (name == "yaml") {
+        return OutputFormat::YAML;
+    } else if (name == "json") {
+        return OutputFormat::JSON;
+    } else if (name == "binary") {
+        return OutputFormat::Binary;
+    }
+    throw std::runtime_error("Unknown output format " + name + "; expected yaml, json, or binary");
+}
+
+static void writeBinary(BufferedWriter& out, const MultiSampleResult& result) {
+    writeBinary(out, result.combined);
+    for (const auto& sample : result.samples) {
+        writeBinary(out, sample);
+    }
+}
+
+template<typename Result>
+static void writeResult(BufferedWriter& out, const Result& result, OutputFormat format) {
+    switch (format) {
+        case OutputFormat::YAML: writeYAML(out, result); break;
+        case OutputFormat::JSON: writeJSON(out, result); break;
+        case OutputFormat::Binary: writeBinary(out, result); break;
+    }
+    out.flush();
+}
+
+void writeResult(std::FILE* out, const CutJetsResult& result, OutputFormat format) {
+    BufferedWriter writer(out);
+    writeResult(writer, result, format);
+}
+
+std::string resultString(const CutJetsResult& result, OutputFormat format) {
+    std::string str;
+    BufferedWriter writer(str);
+    writeResult(writer, result, format);
+    return str;
+}
+
+void writeResult(std::FILE* out, const MultiSampleResult& result, OutputFormat format) {
+    BufferedWriter writer(out);
+    writeResult(writer, result, format);
+}
+
+std::string resultString(const MultiSampleResult& result, OutputFormat format) {
+    std::string str;
+    BufferedWriter writer(str);
+    writeResult(writer, result, format);
+    return str;
+}
+
+
+CutJetsResult readBinaryResult(const std::string& data) {
+    size_t pos = 0;
+    return readBinaryResult(data, pos);
+}
+
+CutJetsResult readBinaryResult(const std::string& data, size_t& pos) {
+    auto take = [&](void* out, size_t size) {
+        if (size > data.size() - pos) {
+            throw std::runtime_error("Binary result is truncated");
+        }
+        std::memcpy(out, data.data() + pos, size);
+        pos += size;
+    };
+    auto takeValue = [&](auto& value) { take(&value, sizeof(value)); };
+    auto takeU64 = [&] {
+        uint64_t value;
+        takeValue(value);
+        return value;
+    };
+    auto takeDouble = [&] {
+        double value;
+        takeValue(value);
+        return value;
+    };
+    auto takeName = [&](size_t size) {
+        std::string name(padTo8(size), '\0');
+        take(name.data(), name.size());
+        name.resize(size);
+        return name;
+    };
+    auto takeDoubles = [&](size_t n) {
+        std::vector<double> values(n);
+        take(values.data(), n * sizeof(double));
+        return values;
+    };
+
+    auto readCut = [&] {
+        CutResult cutResult;
+        cutResult.totalJetsTaken = takeU64();
+        for (auto n = takeU64(); n > 0; n--) {
+            uint32_t sizes[2];
+            takeValue(sizes);
+            std::string name = takeName(sizes[1]);
+            size_t numBins = takeU64();
+            size_t numReplicas = takeU64();
+            double totalWeight = takeDouble();
+            double totalErr = takeDouble();
+
+            if (sizes[0] == INTS) {
+                IntHistogram hist(name, 0);
+                hist.setReplicas(numReplicas);
+                std::vector<int64_t> keys(numBins);
+                take(keys.data(), numBins * sizeof(int64_t));
+                for (int64_t key : keys) {
+                    hist.binSums[key] = takeDouble();
+                }
+                for (int64_t key : keys) {
+                    hist.binErrs[key] = takeDouble();
+                }
+                if (numReplicas > 0) {
+                    for (int64_t key : keys) {
+                        hist.binReplicaErrs[key] = takeDouble();
+                    }
+                }
+                hist.totalWeight = totalWeight;
+                hist.totalErr = totalErr;
+                cutResult.intHistograms.push_back(std::move(hist));
+            } else if (sizes[0] == BINNED) {
+                BinHistogram hist(name, 0, takeDoubles(numBins + 1));
+                hist.setReplicas(numReplicas);
+                hist.binSums = takeDoubles(numBins);
+                hist.binErrs = takeDoubles(numBins);
+                hist.binReplicaErrs = takeDoubles(numReplicas > 0 ? numBins : 0);
+                hist.totalWeight = totalWeight;
+                hist.totalErr = totalErr;
+                cutResult.binHistograms.push_back(std::move(hist));
+            } else if (sizes[0] == QUANTILES) {
+                // The number of bins requested isn't stored, only how many there turned out to be
+                QuantileHistogram hist(name, 0, std::max<size_t>(numBins, 1));
+                hist.binEndpoints = takeDoubles(numBins > 0 ? numBins + 1 : 0);
+                hist.binSums = takeDoubles(numBins);
+                hist.binErrs = takeDoubles(numBins);
+                hist.totalWeight = totalWeight;
+                hist.totalErr = totalErr;
+                cutResult.quantileHistograms.push_back(std::move(hist));
+            } else {
+                throw std::runtime_error("Binary result has unknown histogram kind " + std::to_string(sizes[0]));
+            }
+        }
+        return cutResult;
+    };
+
+    char magic[sizeof(MAGIC)];
+    take(magic, sizeof(magic));
+    if (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error("Not a binary get_cuts result");
+    }
+    uint32_t header[2];
+    takeValue(header);
+    if (header[0] != BYTE_ORDER_MARK) {
+        throw std::runtime_error("Binary result was written with a different byte order");
+    }
+
+    CutJetsResult result;
+    result.numEvents = takeU64();
+    result.totalWeight = takeDouble();
+    result.csOnW = takeDouble();
+    if (takeU64()) {
+        ProgressiveStatus& status = result.progressive.emplace();
+        status.blocksRead = takeU64();
+        status.numBlocks = takeU64();
+        status.fractionRead = takeDouble();
+        status.maxRelativeError = takeDouble();
+    }
+    for (size_t c = 0; c < header[1]; c++) {
+        CutResult cutResult = readCut();
+        size_t numThresholds = takeU64();
+        if (numThresholds > 0) {
+            std::string name = takeName(takeU64());
+            std::vector<double> thresholds;
+            for (size_t i = 0; i < numThresholds; i++) {
+                thresholds.push_back(takeDouble());
+                cutResult.scanWeights.push_back(takeDouble());
+                cutResult.scanResults.push_back(readCut());
+            }
+            cutResult.scan.emplace(name, 0, thresholds.front(), thresholds.back(), numThresholds);
+            cutResult.scan->thresholds = std::move(thresholds);
+        }
+        result.cutResults.push_back(std::move(cutResult));
+    }
+    return result;
+}
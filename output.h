@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#include "get_cuts.h"
+
+enum class OutputFormat {
+    YAML,  // the layout consumed by our analysis scripts, with 6 significant digits
+    JSON,  // compact, with every number written exactly (non-finite numbers are null)
+    Binary,  // raw arrays, described below
+};
+
+// Parse "yaml", "json", or "binary"
+OutputFormat parseOutputFormat(const std::string& name);
+
+// Print a finished result
+void writeResult(std::FILE* out, const CutJetsResult& result, OutputFormat format);
+std::string resultString(const CutJetsResult& result, OutputFormat format);
+
+// Print the results of a multi-sample job: each sample's, labeled with its input, and then the combination. In the
+// binary format, the combined result comes first, followed by each sample's in input order.
+void writeResult(std::FILE* out, const MultiSampleResult& result, OutputFormat format);
+std::string resultString(const MultiSampleResult& result, OutputFormat format);
+
+inline void writeYAML(std::FILE* out, const CutJetsResult& result) {
+    writeResult(out, result, OutputFormat::YAML);
+}
+inline std::string yamlString(const CutJetsResult& result) {
+    return resultString(result, OutputFormat::YAML);
+}
+
+// The binary format holds the same numbers as the YAML, in native byte order and 8-byte aligned (like JetDump.h):
+//
+//   header:     char magic[8] = "GCRSLT2\0", uint32 byteOrder = 0x01020304, uint32 numCuts
+//               uint64 numEvents, double totalWeight, double csOnW, uint64 isProgressive, then if it's 1:
+//               uint64 blocksRead, uint64 numBlocks, double fractionRead, double maxRelativeError
+//   each cut:   cut result, uint64 numThresholds, then if the cut has a scan:
+//               uint64 nameSize, char variable[nameSize] padded to 8, and for each threshold:
+//               double threshold, double totalWeight, cut result
+//   cut result: uint64 totalJetsTaken, uint64 numHistograms, then for each histogram:
+//               uint32 kind (0 = ints, 1 = binned, 2 = quantiles), uint32 nameSize, char name[nameSize] padded to 8
+//               uint64 numBins, uint64 numReplicas, double totalWeight, double totalErr
+//               int64 bins[numBins] (ints) or double endpoints[numBins + 1] (binned; quantiles unless numBins is 0)
+//               double values[numBins], double errs[numBins], double replicaErrs[numReplicas ? numBins : 0]
+//
+// Read a result in that format back. The histograms' variable indices aren't stored, so they're all 0.
+CutJetsResult readBinaryResult(const std::string& data);
+
+// Read the result starting at byte `pos` of `data`, and advance `pos` past it
+CutJetsResult readBinaryResult(const std::string& data, size_t& pos);
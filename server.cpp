@@ -0,0 +1,234 @@
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "This file requires C++17"
+#endif
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "EventStore.h"
+#include "get_cuts.h"
+#include "output.h"
+#include "server.h"
+
+static sockaddr_un socketAddress(const std::string& socketPath) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        throw std::invalid_argument("Socket path too long: " + socketPath);
+    }
+    std::strcpy(addr.sun_path, socketPath.c_str());
+    return addr;
+}
+
+static std::string readAll(int fd) {
+    std::string str;
+    char buf[4096];
+    while (true) {
+        ssize_t len = ::read(fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::system_category(), "Error reading from socket");
+        }
+        if (len == 0) {
+            return str;
+        }
+        str.append(buf, len);
+    }
+}
+
+static void writeAll(int fd, const std::string& str) {
+    size_t written = 0;
+    while (written < str.size()) {
+        ssize_t len = ::send(fd, str.data() + written, str.size() - written, MSG_NOSIGNAL);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::system_category(), "Error writing to socket");
+        }
+        written += len;
+    }
+}
+
+// Owns a socket, closing it when destroyed
+class Socket {
+    int _fd;
+
+public:
+    explicit Socket(int fd) : _fd(fd) {}
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+    ~Socket() {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+    int fd() const {
+        return _fd;
+    }
+};
+
+// Fixed-size pool of threads working through a queue of accepted connections.
+class ConnectionPool {
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<int> _connections;
+    std::vector<std::thread> _threads;
+    bool _stopping = false;
+
+public:
+    template<typename Fn>
+    ConnectionPool(size_t numThreads, Fn handle) {
+        for (size_t i = 0; i < numThreads; i++) {
+            _threads.emplace_back([this, handle] {
+                while (true) {
+                    int fd;
+                    {
+                        std::unique_lock lock(_mutex);
+                        _cv.wait(lock, [&] { return _stopping || !_connections.empty(); });
+                        if (_connections.empty()) {
+                            return;
+                        }
+                        fd = _connections.front();
+                        _connections.pop_front();
+                    }
+                    Socket connection(fd);
+                    handle(connection.fd());
+                }
+            });
+        }
+    }
+
+    ~ConnectionPool() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+        for (auto& thread : _threads) {
+            thread.join();
+        }
+    }
+
+    void push(int fd) {
+        {
+            std::lock_guard lock(_mutex);
+            _connections.push_back(fd);
+        }
+        _cv.notify_one();
+    }
+};
+
+static std::string answer(const Format& format, const std::map<std::string, EventStore>& stores, const std::string& request) {
+    std::string specText = request;
+    const EventStore* store = nullptr;
+
+    const std::string inputPrefix = "input:";
+    if (request.compare(0, inputPrefix.size(), inputPrefix) == 0) {
+        size_t lineEnd = std::min(request.find('\n'), request.size());
+        size_t start = request.find_first_not_of(" \t", inputPrefix.size());
+        size_t end = request.find_last_not_of(" \t\r", lineEnd - 1);
+        std::string input = start < lineEnd ? request.substr(start, end + 1 - start) : "";
+        if (auto found = stores.find(input); found != stores.end()) {
+            store = &found->second;
+        } else {
+            throw std::runtime_error("Input " + input + " is not loaded");
+        }
+        specText = request.substr(lineEnd);
+    } else if (stores.size() == 1) {
+        store = &stores.begin()->second;
+    } else {
+        throw std::runtime_error("Multiple inputs are loaded; choose one with 'input: <path>'");
+    }
+
+    GetCutJetsSpec spec(format, std::move(specText));
+    CutJetsProcessor processor(format, spec);
+    store->replay(processor);
+    return yamlString(processor.finish());
+}
+
+void runServer(const Format& format, const std::string& socketPath, const std::vector<std::string>& inputs) {
+    std::map<std::string, EventStore> stores;
+    for (const auto& input : inputs) {
+        stores.emplace(input, loadEvents(format, input.c_str()));
+        const auto& store = stores.at(input);
+        std::fprintf(stderr, "Loaded %s: %zu events, %zu jets\n", input.c_str(), store.numEvents(), store.numJets());
+    }
+
+    Socket listener(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (listener.fd() < 0) {
+        throw std::system_error(errno, std::system_category(), "Error creating socket");
+    }
+    sockaddr_un addr = socketAddress(socketPath);
+    ::unlink(socketPath.c_str());
+    if (::bind(listener.fd(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        throw std::system_error(errno, std::system_category(), "Error binding " + socketPath);
+    }
+    if (::listen(listener.fd(), SOMAXCONN) != 0) {
+        throw std::system_error(errno, std::system_category(), "Error listening on " + socketPath);
+    }
+    std::fprintf(stderr, "Listening on %s\n", socketPath.c_str());
+
+    // Queries only read from the stores, so they can run concurrently.
+    ConnectionPool pool(std::max(1u, std::thread::hardware_concurrency()), [&](int fd) {
+        std::string response;
+        try {
+            response = answer(format, stores, readAll(fd));
+        } catch (const std::exception& e) {
+            response = std::string("error: ") + e.what() + "\n";
+        }
+        try {
+            writeAll(fd, response);
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+        }
+    });
+
+    while (true) {
+        int fd = ::accept(listener.fd(), nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::system_category(), "Error accepting connection");
+        }
+        pool.push(fd);
+    }
+}
+
+int runQuery(const std::string& socketPath, const std::string& input, std::istream& spec) {
+    Socket connection(::socket(AF_UNIX, SOCK_STREAM, 0));
+    int fd = connection.fd();
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(), "Error creating socket");
+    }
+    sockaddr_un addr = socketAddress(socketPath);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        throw std::system_error(errno, std::system_category(), "Error connecting to " + socketPath);
+    }
+
+    std::string request;
+    if (!input.empty()) {
+        request = "input: " + input + "\n";
+    }
+    request.append(std::istreambuf_iterator<char>(spec), std::istreambuf_iterator<char>());
+    writeAll(fd, request);
+    ::shutdown(fd, SHUT_WR);
+
+    std::string response = readAll(fd);
+    std::fwrite(response.data(), 1, response.size(), stdout);
+    return response.compare(0, 6, "error:") == 0 ? 1 : 0;
+}
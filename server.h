@@ -0,0 +1,15 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "get_cuts.h"
+
+// Load each input into memory once, then answer GetCutJetsSpec queries on the Unix socket at `socketPath` until
+// killed. A request is the spec text, optionally preceded by an "input: <path>" line choosing which input to use;
+// the connection is half-closed after the request and the server replies with the YAML result (or "error: ...").
+void runServer(const Format& format, const std::string& socketPath, const std::vector<std::string>& inputs);
+
+// Send the spec read from `spec` to a running server and copy its response to stdout. Returns the exit status.
+int runQuery(const std::string& socketPath, const std::string& input, std::istream& spec);
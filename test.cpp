@@ -1,9 +1,26 @@
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <numeric>
+#include <random>
 #include <sstream>
 
+#include <unistd.h>
+
+#include "CpuDispatch.h"
+#include "CutJetsSession.h"
+#include "EventStore.h"
 #include "Histogram.h"
+#include "HistogramArena.h"
+#include "JetDump.h"
+#include "ResultCache.h"
+#include "WorkStealingPool.h"
+#include "ZoneMap.h"
 #include "get_cuts.h"
+#include "output.h"
 
 template<typename T>
 static bool vectorsEqual(const std::vector<T>& v1, const std::vector<T>& v2) {
@@ -30,6 +47,48 @@ static void assertThrows(const std::string& expected, Fn&& fn) {
     throw std::runtime_error("No error was thrown, expected'" + expected + "'");
 }
 
+// Write `contents` to a temporary file which is deleted when the returned object is destroyed.
+struct TempFile {
+    std::string path;
+
+    TempFile(const std::string& contents) {
+        char name[] = "/tmp/get_cuts_test.XXXXXX";
+        int fd = mkstemp(name);
+        if (fd < 0 || write(fd, contents.data(), contents.size()) != ssize_t(contents.size())) {
+            throw std::runtime_error("Unable to write temporary file");
+        }
+        close(fd);
+        path = name;
+    }
+
+    ~TempFile() {
+        unlink(path.c_str());
+    }
+};
+
+static Format testFormat({
+    "VAR_NUM", "VAR_WEIGHT", "VAR_PT", "Z_PX", "Z_PY", "Z_PZ", "Z_E", "Z_RAP", "GLUON_FLAG_1", "GLUON_FLAG_2", "VAR_M",
+});
+
+static const char* testInput = R"(header
+New Event
+0.5, 2.0
+H 1 2 3 4 5 6 1 0
+M 1 2 3 10
+M 1 2 -1 10
+0, 30, 1.5
+1, 20, 2.5
+2, 10, 3.5
+New Event
+2.0, 3.0
+0, 50, 4.5
+1, 45, 0.5
+New Event
+1.5, 4.0
+H 1 2 3 4 5 6 0 0
+0, 5, 9
+)";
+
 static void testParseSpec() {
     Format format({
         "VAR_0", "VAR_1", "VAR_2",
@@ -140,6 +199,19 @@ static void testParseSpec() {
     assert(spec.cuts[1].binHistograms[0].binEndpoints.front() == 0);
     assert(spec.cuts[1].binHistograms[0].binEndpoints.back() == 10.5);
     assert(spec.cuts[1].binHistograms[0].binSums.size() == 5);
+
+    // Custom bins may be followed by spaces or the end of the spec
+    const char* settings = "takeNum: 1\nskipNum: 0\nstrict: true\neventProbabilityMultiplier: nan\nrandomSeed: 5\n";
+    GetCutJetsSpec custom(format, std::string(settings) + "new_cut\nVAR_1 0 1\nhistogram_custom: VAR_2 1 2  \t\n"
+                                                         "new_cut\nVAR_1 0 1\nhistogram_custom: VAR_0 3 4 5");
+    assert(vectorsEqual(custom.cuts[0].binHistograms[0].binEndpoints, {1, 2}));
+    assert(vectorsEqual(custom.cuts[1].binHistograms[0].binEndpoints, {3, 4, 5}));
+    assertThrows("Expected max value for VAR_1 in spec", [&]{
+        GetCutJetsSpec(format, std::string(settings) + "new_cut\nVAR_1 0");
+    });
+    assertThrows("Error reading spec; expected doubles", [&]{
+        GetCutJetsSpec(format, std::string(settings) + "new_cut\nVAR_1 0 1\nhistogram_custom: VAR_2 1 2x\n");
+    });
 }
 
 static void testIntHistogram() {
@@ -232,10 +304,1101 @@ static void testCustomHistogram() {
     assert(vectorsEqual(h.binErrs, {2 / 4.0 / 5.0, 3 / 1.0 / 5.0}));
 }
 
+static void testQuantileHistogram() {
+    assertThrows("Histogram must have at least 1 bin", []{ QuantileHistogram h("foo", 0, 0); });
+
+    // 10000 values uniform in [0, 100) where the upper half has twice the weight
+    QuantileHistogram whole("foo", 0, 4);
+    QuantileHistogram lower("foo", 0, 4);
+    QuantileHistogram upper("foo", 0, 4);
+    for (int i = 0; i < 10000; i++) {
+        double val = i / 100.0;
+        double weight = val < 50 ? 1 : 2;
+        whole.add(weight, {val});
+        (i % 2 ? lower : upper).add(weight, {val});
+    }
+    lower.merge(upper);
+
+    for (auto* h : {&whole, &lower}) {
+        h->finish();
+        assert(h->totalWeight == 15000);
+        assert(h->binEndpoints.size() == 5);
+        assert(h->binEndpoints.front() == 0);
+        assert(h->binEndpoints.back() == 99.99);
+        // equal-weight bins: a quarter of the weight is [0, 37.5), then [37.5, 62.5), [62.5, 81.25), [81.25, 100)
+        assert(std::abs(h->binEndpoints[1] - 37.5) < 0.5);
+        assert(std::abs(h->binEndpoints[2] - 62.5) < 0.5);
+        assert(std::abs(h->binEndpoints[3] - 81.25) < 0.5);
+        for (size_t i = 0; i < 4; i++) {
+            double fraction = h->binSums[i] * (h->binEndpoints[i + 1] - h->binEndpoints[i]);
+            assert(std::abs(fraction - 0.25) < 0.01);
+        }
+        // errors follow sqrt(sum w^2) for the weight in each bin: the first bin has 3750 jets of weight 1
+        assert(std::abs(h->binErrs[0] * (h->binEndpoints[1] - h->binEndpoints[0]) - std::sqrt(3750.0) / 15000) < 1e-4);
+    }
+
+    // The same net weights, with each value in the lower half added with weight 2 and -1. Bins hold equal absolute
+    // weight (3 per value below 50, 2 above), so the endpoints move to 20.83, 41.67, and 68.75, but the histogram
+    // still integrates to 1.
+    QuantileHistogram signedWeights("foo", 0, 4);
+    for (int i = 0; i < 10000; i++) {
+        double val = i / 100.0;
+        signedWeights.add(2, {val});
+        if (val < 50) {
+            signedWeights.add(-1, {val});
+        }
+    }
+    signedWeights.finish();
+    assert(signedWeights.totalWeight == 15000);
+    assert(std::abs(signedWeights.binEndpoints[1] - 20.83) < 0.5);
+    assert(std::abs(signedWeights.binEndpoints[3] - 68.75) < 0.5);
+    double integral = 0;
+    for (size_t i = 0; i < 4; i++) {
+        integral += signedWeights.binSums[i] * (signedWeights.binEndpoints[i + 1] - signedWeights.binEndpoints[i]);
+    }
+    assert(std::abs(integral - 1) < 1e-3);  // the digests interpolate within their outermost centroids
+    double lastWidth = signedWeights.binEndpoints[4] - signedWeights.binEndpoints[3];
+    assert(std::abs(signedWeights.binSums[3] * lastWidth - 6250 / 15000.0) < 0.01);
+    // errors count the weights of both signs: 2083 values with 2^2 + 1^2 in the first bin
+    double firstWidth = signedWeights.binEndpoints[1] - signedWeights.binEndpoints[0];
+    assert(std::abs(signedWeights.binErrs[0] * firstWidth - std::sqrt(2083 * 5.0) / 15000) < 1e-3);
+}
+
+static void testBootstrap() {
+    // Weights depend only on (seed, event, replica), and follow Poisson(1)
+    std::vector<double> weights(10000);
+    bootstrapWeights(5, 123, weights);
+    std::vector<double> again(10000);
+    bootstrapWeights(5, 123, again);
+    assert(weights == again);
+    bootstrapWeights(5, 124, again);
+    assert(weights != again);
+    double mean = std::accumulate(weights.begin(), weights.end(), 0.0) / weights.size();
+    double zeros = std::count(weights.begin(), weights.end(), 0.0) / double(weights.size());
+    assert(std::abs(mean - 1) < 0.05);
+    assert(std::abs(zeros - std::exp(-1.0)) < 0.02);
+
+    BinHistogram h("foo", 0, 0.0, 2.0, 2);
+    h.setReplicas(3);
+    double replicaWeights1[] = {0, 1, 2};
+    double replicaWeights2[] = {1, 1, 3};
+    h.add(0.5, {0.5}, replicaWeights1);
+    h.add(0.5, {1.5}, replicaWeights2);
+    h.add(0.5, {2.5}, replicaWeights2);  // out of range
+    assert(vectorsEqual(h.replicaTotals, {0.5, 1.0, 2.5}));
+    assert(vectorsEqual(h.replicaSums, {0.0, 0.5, 1.0, 0.5, 0.5, 1.5}));
+    h.finish();
+    // the first bin holds fractions 0, 0.5, 0.4 of each replica
+    double mean0 = (0 + 0.5 + 0.4) / 3;
+    double spread0 = std::sqrt((mean0 * mean0 + (0.5 - mean0) * (0.5 - mean0) + (0.4 - mean0) * (0.4 - mean0)) / 2);
+    assert(std::abs(h.binReplicaErrs[0] - spread0) < 1e-12);
+
+    IntHistogram ih("foo", 0);
+    ih.setReplicas(3);
+    ih.add(0.5, {1}, replicaWeights1);
+    ih.add(0.5, {2}, replicaWeights2);
+    ih.finish();
+    assert(std::abs(ih.binReplicaErrs[1] - spread0) < 1e-12);
+
+    // A processor's replicas follow each event's position in the input, not the order the events are fed in
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 1
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 2
+        bootstrapReplicas: 5
+
+        new_cut
+        VAR_PT 0 100
+        histogram: VAR_M 0 10 2
+    )");
+    std::vector<std::vector<double>> replicaErrs;
+    for (bool reversed : {false, true}) {
+        CutJetsProcessor processor(testFormat, spec);
+        for (uint64_t i = 0; i < 20; i++) {
+            uint64_t eventIndex = reversed ? 19 - i : i;
+            processor.beginEvent(eventIndex, 1, 1);
+            assert(processor.wantJet());
+            processor.addJet(Jet{0, 10, eventIndex % 3 ? 7.0 : 2.0});
+        }
+        replicaErrs.push_back(processor.finish().cutResults[0].binHistograms[0].binReplicaErrs);
+    }
+    assert(replicaErrs[0][0] > 0 && vectorsEqual(replicaErrs[0], replicaErrs[1]));
+}
+
+static void testHistogramArena() {
+    // Fills through the arena match BinHistogram::add, including at bin edges and with uneven bins
+    std::vector<BinHistogram> hists = {
+        BinHistogram("foo", 0, 2.0, 5.0, 6),
+        BinHistogram("bar", 1, 0.1, 0.7, 3),
+        BinHistogram("baz", 0, {1.0, 2.5, 2.6, 4.0}),
+    };
+    for (auto& hist : hists) {
+        hist.setReplicas(2);
+    }
+    auto direct = hists;
+    HistogramArena arena;
+    arena.addGroup({});
+    size_t group = arena.addGroup(hists);
+    assert(group == 1);
+
+    std::vector<double> values = {NAN, INFINITY, 0.1, 0.3, 0.7, std::nextafter(0.7, 1.0), 2.5, 2.6, 5.0};
+    for (double edge : direct[0].binEndpoints) {
+        values.push_back(edge);
+        values.push_back(std::nextafter(edge, 0));
+    }
+    double replicaWeights[] = {2, 0};
+    for (size_t i = 0; i < values.size(); i++) {
+        Jet jet = {values[i], values[values.size() - 1 - i]};
+        arena.fill(group, i + 1, jet, replicaWeights);
+        for (auto& hist : direct) {
+            hist.add(i + 1, jet, replicaWeights);
+        }
+    }
+
+    arena.store(group, hists);
+    for (size_t i = 0; i < hists.size(); i++) {
+        assert(hists[i].totalWeight == direct[i].totalWeight);
+        assert(hists[i].totalErr == direct[i].totalErr);
+        assert(vectorsEqual(hists[i].binSums, direct[i].binSums));
+        assert(vectorsEqual(hists[i].binErrs, direct[i].binErrs));
+        assert(vectorsEqual(hists[i].replicaTotals, direct[i].replicaTotals));
+        assert(vectorsEqual(hists[i].replicaSums, direct[i].replicaSums));
+    }
+
+    // Restoring from stored histograms continues where they left off
+    HistogramArena restored;
+    restored.addGroup(direct);
+    restored.load(0, hists);
+    restored.fill(0, 1, {3.0, 0.2}, replicaWeights);
+    restored.store(0, hists);
+    assert(hists[0].binSums[2] == direct[0].binSums[2] + 1);
+    assert(hists[1].binSums[0] == direct[1].binSums[0] + 1);
+    assert(hists[2].binSums[2] == direct[2].binSums[2] + 1);
+}
+
+static void testCpuKernels() {
+    std::vector<std::string> numbers = {
+        "0", "-0", "3.76413", " -2.4368", "\t1e5", "1.5E-3", "+.5", "5.", "007", "0.0015", "123456789012345678901234",
+        "1e-30", "9007199254740993", "0x10", "inf", "-nan", "1e", "-", ".", "2.5, 3",
+    };
+    std::mt19937_64 random(1);
+    for (int i = 0; i < 1000; i++) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.*g", int(random() % 17) + 1, std::ldexp(double(random() % 1000000) - 500000, int(random() % 40) - 30));
+        numbers.push_back(buf);
+    }
+
+    std::string text(300, 'x');
+    for (size_t i : {0, 17, 40, 41, 100, 250}) {
+        text[i] = '\n';
+    }
+
+    for (int level = 0; level <= int(detectCpuLevel()); level++) {
+        const auto& kernels = cpuKernelsFor(CpuLevel(level));
+
+        for (size_t start = 0; start < text.size(); start++) {
+            for (size_t end : {start, start + 1, start + 35, text.size()}) {
+                end = std::min(end, text.size());
+                const char* expected = std::find(text.data() + start, text.data() + end, '\n');
+                assert(kernels.findNewline(text.data() + start, text.data() + end) == expected);
+            }
+        }
+
+        for (const auto& number : numbers) {
+            double val;
+            const char* end = kernels.parseDouble(number.c_str(), &val);
+            if (end) {
+                char* expectedEnd;
+                double expected = std::strtod(number.c_str(), &expectedEnd);
+                assert(end == expectedEnd);
+                assert(std::memcmp(&val, &expected, sizeof(val)) == 0);
+            }
+        }
+        double unused;
+        assert(kernels.parseDouble("0x10", &unused) == nullptr);
+
+        Jet jet = {1, 2, NAN, 4, 5, 6, 7, 8, 9, 10};
+        for (size_t numClauses = 0; numClauses <= 11; numClauses++) {
+            for (int trial = 0; trial < 50; trial++) {
+                std::vector<CutClause> clauses;
+                for (size_t i = 0; i < numClauses; i++) {
+                    size_t varIndex = random() % jet.size();
+                    double min = jet[varIndex] - (random() % 3 == 0 ? -1 : 1);
+                    clauses.push_back({varIndex, min, min + 2});
+                }
+                bool expected = std::all_of(clauses.begin(), clauses.end(), [&](const auto& c) { return c.matches(jet); });
+                assert(kernels.clausesMatch(clauses.data(), clauses.size(), jet) == expected);
+            }
+        }
+        std::vector<CutClause> outOfRange = {{0, 0, 2}, {jet.size(), 0, 1}, {1, 0, 3}};
+        assertThrows("Variable 10 out of range", [&] { kernels.clausesMatch(outOfRange.data(), outOfRange.size(), jet); });
+        outOfRange[0].max = 0.5;  // a failing clause comes first
+        assert(!kernels.clausesMatch(outOfRange.data(), outOfRange.size(), jet));
+
+        for (size_t n : {0, 1, 2, 5, 8, 9, 64, 100}) {
+            std::vector<double> values(n);
+            std::iota(values.begin(), values.end(), 0.0);
+            for (double x : {-1.0, 0.0, 0.5, 3.0, 7.5, 8.0, 63.0, 99.0, 1000.0, -HUGE_VAL, HUGE_VAL}) {
+                size_t expected = std::upper_bound(values.begin(), values.end(), x) - values.begin();
+                assert(kernels.upperBound(values.data(), n, x) == expected);
+            }
+        }
+    }
+
+    // The report names the variant each kernel runs, which for number parsing is the same at every level
+    std::string report = cpuFeatureReport();
+    assert(report.find(std::string("selected: ") + cpuLevelName(cpuKernels().level)) != std::string::npos);
+    assert(report.find("  number parsing: scalar\n") != std::string::npos);
+}
+
+static void testExpression() {
+    std::vector<std::string> names = {"A", "B", "C"};
+    auto lookup = [&](const std::string& name) { return indexOf(names, name); };
+    auto eval = [&](const std::string& text) {
+        return Expression(text, lookup).evaluate(std::vector<double>{2, 3, -4}.data());
+    };
+
+    assert(eval("A + B * C") == 2 + 3 * -4);
+    assert(eval("(A + B) * C") == (2 + 3) * -4);
+    assert(eval("A - B - C") == 2 - 3 - -4);
+    assert(eval("A / B / C") == 2.0 / 3 / -4);
+    assert(eval("-A^2") == -4);
+    assert(eval("A^B^A") == std::pow(2, 9));
+    assert(eval("2^-1") == 0.5);
+    assert(eval("1.5e1 + -C") == 19);
+    assert(eval("hypot(B, C)") == 5);
+    assert(eval("sqrt(abs(C)) * max(A, B)") == 6);
+    assert(std::abs(eval("dphi(0.1, 2 * pi - 0.1)") - 0.2) < 1e-12);
+    assert(eval("atan2(B, A)") == std::atan2(3, 2));
+
+    assert(Expression("A * (B + 1)", lookup).inputs() == std::vector<size_t>({0, 1}));
+    Expression expr("-A + min(B, 2 ^ C) / 0.25", lookup);
+    std::string text = expr.toString([&](size_t i) { return names[i]; });
+    assert(text == "((-A) + (min(B, (2 ^ C)) / 0.25))");
+    assert(Expression(text, lookup).toString([&](size_t i) { return names[i]; }) == text);
+
+    assertThrows("unrecognized variable D", [&]{ eval("A + D"); });
+    assertThrows("Unknown function foo at position 4 of expression 'foo(A)'", [&]{ eval("foo(A)"); });
+    assertThrows("Expected ')' at position 6 of expression '(A + B'", [&]{ eval("(A + B"); });
+    assertThrows("Unexpected 'B' at position 2 of expression 'A B'", [&]{ eval("A B"); });
+    assertThrows("hypot expects 2 arguments at position 7 of expression 'hypot(A)'", [&]{ eval("hypot(A)"); });
+}
+
+static void testDerivedVariables() {
+    TempFile input(testInput);
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 5
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+        define: Z_PT = hypot(Z_PX, Z_PY)
+        define: BALANCE = VAR_PT / Z_PT
+        define: DOUBLE_M = 2 * VAR_M
+
+        new_cut
+        BALANCE 1 10
+        histogram: DOUBLE_M 0 8 4
+    )");
+    assert(spec.defines.size() == 3);
+    assert(spec.defines[0].varIndex == testFormat.numVars());
+    assert(spec.defines[0].neededByClauses && !spec.defines[0].neededByHistograms);
+    assert(spec.defines[1].neededByClauses && !spec.defines[1].neededByHistograms);
+    assert(!spec.defines[2].neededByClauses && spec.defines[2].neededByHistograms);
+    assert(spec.cuts[0].clauses[0].varIndex == testFormat.numVars() + 1);
+
+    // Only the first event has Z data, with Z_PT = hypot(2, 4), and all of its jets pass; without Z data the
+    // balance is 0
+    CutJetsResult result = getCutJets(testFormat, input.path.c_str(), spec);
+    assert(result.cutResults[0].totalJetsTaken == 3);
+    assert(vectorsEqual(result.cutResults[0].binHistograms[0].binSums, {0.0, 0.5 / 2 / 1.5, 0.5 / 2 / 1.5, 0.5 / 2 / 1.5}));
+
+    assertThrows("Variable VAR_PT is already defined", [&]{
+        GetCutJetsSpec(testFormat, "takeNum: 1 skipNum: 0 strict: false eventProbabilityMultiplier: nan randomSeed: 0\n"
+                                   "define: VAR_PT = 1\n");
+    });
+    assertThrows("unrecognized variable LATER", [&]{
+        GetCutJetsSpec(testFormat, "takeNum: 1 skipNum: 0 strict: false eventProbabilityMultiplier: nan randomSeed: 0\n"
+                                   "define: EARLIER = LATER\ndefine: LATER = 1\n");
+    });
+}
+
+static void testEventClauses() {
+    TempFile input(testInput);
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 5
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+        define: Z_PT = hypot(Z_PX, Z_PY)
+        define: PT_PER_WEIGHT = VAR_PT / VAR_WEIGHT
+
+        new_cut
+        GLUON_FLAG_1 1 1
+        Z_PT 4 5
+        VAR_PT 15 100
+        histogram_ints: VAR_NUM
+
+        new_cut
+        VAR_WEIGHT 1 2
+        histogram_ints: VAR_NUM
+        histogram: PT_PER_WEIGHT 0 10 1
+    )");
+    assert(spec.defines[0].eventLevel && spec.defines[0].neededByEventClauses && !spec.defines[0].neededByClauses);
+    assert(!spec.defines[1].eventLevel && !spec.defines[1].neededByEventClauses);
+    assert(spec.cuts[0].eventClauses.size() == 2 && spec.cuts[0].jetClauses.size() == 1);
+    assert(spec.cuts[0].jetClauses[0].varIndex == testFormat.var("VAR_PT"));
+    assert(spec.cuts[1].eventClauses.size() == 1 && spec.cuts[1].jetClauses.empty());
+
+    // Only the first event has GLUON_FLAG_1 = 1 and Z_PT = hypot(2, 4); the last two have weights in [1, 2]
+    CutJetsResult result = getCutJets(testFormat, input.path.c_str(), spec);
+    assert(result.cutResults[0].totalJetsTaken == 2);
+    assert(result.cutResults[1].totalJetsTaken == 3);
+    assert(result.cutResults[1].binHistograms[0].totalWeight == 1.5);  // only 5 / 1.5 is below 10
+
+    // Jets of events which fail every cut's event-level clauses aren't parsed
+    std::string badJet = testInput;
+    badJet.replace(badJet.find("1, 45, 0.5"), 10, "1, 45, bad");
+    TempFile badInput(badJet);
+    assertThrows("Unable to read double", [&] { getCutJets(testFormat, badInput.path.c_str(), spec); });
+    GetCutJetsSpec firstEventOnly(testFormat, R"(
+        takeNum: 5 skipNum: 0 strict: false eventProbabilityMultiplier: nan randomSeed: 0
+        new_cut
+        VAR_WEIGHT 0 1
+        histogram_ints: VAR_NUM
+    )");
+    assert(getCutJets(testFormat, badInput.path.c_str(), firstEventOnly).cutResults[0].totalJetsTaken == 3);
+}
+
+static void testManyCuts() {
+    TempFile input(testInput);
+    std::string settings = "takeNum: 1\nskipNum: 0\nstrict: false\neventProbabilityMultiplier: nan\nrandomSeed: 0\n";
+    std::string cuts[] = {
+        "new_cut\nVAR_WEIGHT 1 2\nVAR_PT 0 100\nhistogram_ints: VAR_NUM\n",
+        "new_cut\nVAR_PT 0 46\nhistogram_ints: VAR_NUM\n",
+    };
+    std::string text = settings;
+    for (size_t i = 0; i < 1000; i++) {
+        text += cuts[i % 2];
+    }
+
+    // Each copy of a cut takes the same jets as it would alone, however many other cuts are open in the event
+    auto result = getCutJets(testFormat, input.path.c_str(), GetCutJetsSpec(testFormat, std::move(text)));
+    assert(result.cutResults.size() == 1000);
+    for (size_t c = 0; c < 2; c++) {
+        auto alone = getCutJets(testFormat, input.path.c_str(), GetCutJetsSpec(testFormat, settings + cuts[c]));
+        const auto& expected = alone.cutResults[0].intHistograms[0];
+        for (size_t i = c; i < result.cutResults.size(); i += 2) {
+            const auto& actual = result.cutResults[i].intHistograms[0];
+            assert(result.cutResults[i].totalJetsTaken == alone.cutResults[0].totalJetsTaken);
+            assert(actual.binSums == expected.binSums && actual.binErrs == expected.binErrs);
+        }
+    }
+    assert(result.cutResults[0].totalJetsTaken == 2 && result.cutResults[1].totalJetsTaken == 3);
+}
+
+static void testJetDump() {
+    TempFile input(testInput);
+    TempFile dump("");
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 2
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+
+        new_cut
+        VAR_PT 15 100
+        histogram_ints: VAR_NUM
+
+        new_cut
+        VAR_M 3 10
+        histogram_ints: VAR_NUM
+    )");
+    JetDumpWriter writer(dump.path, testFormat, spec.cuts.size());
+    getCutJets(testFormat, input.path.c_str(), spec, &writer);
+    writer.close();
+
+    JetDumpReader reader(dump.path);
+    assert(reader.vars() == testFormat.vars);
+    assert(reader.numCuts() == 2);
+    // Both cuts fit in a single batch
+    assert(reader.batches().size() == 2);
+    for (const auto& batch : reader.batches()) {
+        auto pt = batch.column(testFormat.var("VAR_PT"));
+        auto m = batch.column(testFormat.var("VAR_M"));
+        auto num = batch.column(testFormat.var("VAR_NUM"));
+        if (batch.cutIndex == 0) {
+            assert(batch.numJets == 4);
+            assert(vectorsEqual(std::vector<double>(pt, pt + 4), {30, 20, 50, 45}));
+            assert(vectorsEqual(std::vector<double>(batch.weights, batch.weights + 4), {0.5, 0.5, 2.0, 2.0}));
+            assert(vectorsEqual(std::vector<uint64_t>(batch.eventOrdinals, batch.eventOrdinals + 4), {0, 0, 1, 1}));
+            assert(vectorsEqual(std::vector<double>(num, num + 4), {0, 1, 0, 1}));
+        } else {
+            assert(batch.numJets == 3);
+            assert(vectorsEqual(std::vector<double>(m, m + 3), {3.5, 4.5, 9}));
+            assert(vectorsEqual(std::vector<uint64_t>(batch.eventOrdinals, batch.eventOrdinals + 3), {0, 1, 2}));
+        }
+    }
+
+    // A dump that wasn't closed is missing its end marker
+    {
+        JetDumpWriter unfinished(dump.path, testFormat, 1);
+        unfinished.add(0, 0, 1.0, Jet(testFormat.numVars(), 1.0));
+    }
+    assertThrows("Jet dump " + dump.path + " is truncated", [&] { JetDumpReader truncated(dump.path); });
+}
+
+static void testResultCache() {
+    TempFile input(testInput);
+    char dirName[] = "/tmp/get_cuts_cache.XXXXXX";
+    if (!mkdtemp(dirName)) {
+        throw std::runtime_error("Unable to create temporary directory");
+    }
+    std::string dir = dirName;
+    const char* settings = R"(
+        takeNum: 2
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+    )";
+    GetCutJetsSpec spec(testFormat, std::string(settings) + R"(
+        new_cut
+        VAR_PT 15 100
+        VAR_M 3 10
+        histogram_ints: VAR_NUM
+        histogram_custom: VAR_M 0 5 10
+
+        new_cut
+        VAR_M 3 10
+        histogram_quantiles: VAR_PT 2
+    )");
+    std::string expected = yamlString(getCutJets(testFormat, input.path.c_str(), spec));
+
+    ResultCache cache(dir, input.path.c_str());
+    assert(!cache.loadOutput(testFormat, spec));
+    assert(yamlString(cache.getCutJets(testFormat, input.path.c_str(), spec)) == expected);
+    assert(cache.piecesReused() == 0 && cache.piecesComputed() == 6);
+    assert(yamlString(cache.getCutJets(testFormat, input.path.c_str(), spec)) == expected);
+    assert(cache.piecesReused() == 6 && cache.piecesComputed() == 0);
+    cache.storeOutput(testFormat, spec, expected);
+    assert(cache.loadOutput(testFormat, spec) == expected);
+
+    // Clause and cut order don't matter; only the new histogram is computed
+    GetCutJetsSpec other(testFormat, std::string(settings) + R"(
+        new_cut
+        VAR_M 3 10
+        histogram_quantiles: VAR_PT 2
+        histogram_ints: VAR_NUM
+
+        new_cut
+        VAR_M 3 10
+        VAR_PT 15 100
+        histogram_custom: VAR_M 0 5 10
+    )");
+    std::string otherExpected = yamlString(getCutJets(testFormat, input.path.c_str(), other));
+    assert(yamlString(cache.getCutJets(testFormat, input.path.c_str(), other)) == otherExpected);
+    assert(cache.piecesReused() == 5 && cache.piecesComputed() == 1);
+
+    // Changing the input invalidates everything
+    std::ofstream(input.path, std::ios::app) << "New Event\n1, 1\n";
+    ResultCache changed(dir, input.path.c_str());
+    assert(!changed.loadOutput(testFormat, spec));
+    changed.getCutJets(testFormat, input.path.c_str(), spec);
+    assert(changed.piecesReused() == 0);
+
+    std::filesystem::remove_all(dir);
+}
+
+static void testZoneMap() {
+    TempFile input(testInput);
+    TempFile saved("");
+    buildZoneMap(testFormat, input.path.c_str(), 2).save(saved.path);
+    ZoneMap zoneMap = ZoneMap::load(saved.path);
+    assert(zoneMap.vars == testFormat.vars);
+    assert(zoneMap.blocks.size() == 2);
+    const auto& first = zoneMap.blocks[0];
+    const auto& second = zoneMap.blocks[1];
+    assert(first.startOffset == 7 && first.endOffset == second.startOffset && second.endOffset == zoneMap.inputSize);
+    assert(first.eventsThrough == 2 && first.weightThrough == 2.5 && first.crossSection == 3.0);
+    assert(second.eventsThrough == 3 && second.weightThrough == 4.0 && second.crossSection == 4.0);
+    size_t pt = testFormat.var("VAR_PT");
+    size_t gluon = testFormat.var("GLUON_FLAG_1");
+    assert(first.min[pt] == 10 && first.max[pt] == 50 && first.min[gluon] == 1 && first.max[gluon] == 2);
+    assert(second.min[pt] == 5 && second.max[pt] == 5 && second.min[gluon] == 0 && second.max[gluon] == 0);
+
+    const char* settings = R"(
+        takeNum: 2
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+        bootstrapReplicas: 4
+    )";
+    auto expectSame = [&](const std::string& cuts, const std::vector<bool>& toRead) {
+        GetCutJetsSpec spec(testFormat, settings + cuts);
+        assert(zoneMap.blocksToRead(spec) == toRead);
+        assert(yamlString(getCutJets(testFormat, input.path.c_str(), spec, zoneMap)) ==
+               yamlString(getCutJets(testFormat, input.path.c_str(), spec)));
+    };
+    expectSame(R"(
+        new_cut
+        VAR_PT 40 100
+        histogram_ints: VAR_NUM
+    )", {true, false});
+    expectSame(R"(
+        new_cut
+        VAR_PT 0 6
+        histogram_ints: VAR_NUM
+    )", {false, true});
+    // Clauses on derived variables can't rule out a block
+    expectSame(R"(
+        define: PT2 = VAR_PT * 2
+        new_cut
+        PT2 0 1
+        histogram_ints: VAR_NUM
+
+        new_cut
+        VAR_PT 100 200
+        histogram_ints: VAR_NUM
+    )", {true, true});
+    expectSame(R"(
+        new_cut
+        VAR_PT 100 200
+        histogram_ints: VAR_NUM
+    )", {false, false});
+
+    // Rewriting the input with the same size (here, with two jets' values swapped) invalidates the zone map too
+    std::string rewritten = testInput;
+    std::swap_ranges(rewritten.begin() + rewritten.find("0, 30"), rewritten.begin() + rewritten.find("0, 30") + 5,
+                     rewritten.begin() + rewritten.find("2, 10"));
+    assert(rewritten.size() == std::string(testInput).size() && rewritten != testInput);
+    for (const std::string& contents : {rewritten, std::string(testInput) + "New Event\n1, 1\n"}) {
+        std::ofstream(input.path, std::ios::trunc) << contents;
+        assertThrows("Zone map was built for a different version of " + input.path, [&] {
+            getCutJets(testFormat, input.path.c_str(), GetCutJetsSpec(testFormat, settings), zoneMap);
+        });
+    }
+}
+
+static void testPipeline() {
+    // Enough events to fill several batches
+    std::string events = std::string(testInput).substr(std::strlen("header\n"));
+    std::string contents = "header\n";
+    for (size_t i = 0; i < 1000; i++) {
+        contents += events;
+    }
+    TempFile input(contents);
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 1
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: 0.5
+        randomSeed: 3
+        bootstrapReplicas: 4
+
+        new_cut
+        VAR_PT 15 100
+        GLUON_FLAG_1 1 2
+        histogram_ints: VAR_NUM
+        histogram_custom: VAR_M 0 5 10
+        histogram_quantiles: VAR_M 2
+    )");
+    PipelineStats stats;
+    auto pipelined = getCutJets(testFormat, input.path.c_str(), spec, stats);
+    assert(yamlString(pipelined) == yamlString(getCutJets(testFormat, input.path.c_str(), spec)));
+    assert(stats.stages.size() == 3);
+    for (const auto& stage : stats.stages) {
+        assert(stage.busySeconds >= 0 && stage.busySeconds <= stats.wallSeconds);
+    }
+
+    // Errors in any stage are reported after the other stages have stopped
+    TempFile badInput(contents + "New Event\n1, 1\n0, 1\n");
+    assertThrows("Expected jet to have 11 values, but encountered 10", [&] {
+        getCutJets(testFormat, badInput.path.c_str(), spec, stats);
+    });
+    // ...including when the error comes early in an input with more chunks than the pipeline holds at once
+    std::string longContents = "header\nNew Event\n1, 1\n0, 1\n";
+    while (longContents.size() < (size_t(9) << 20)) {
+        longContents += events;
+    }
+    TempFile earlyBadInput(longContents);
+    assertThrows("Expected jet to have 11 values, but encountered 10", [&] {
+        getCutJets(testFormat, earlyBadInput.path.c_str(), spec, stats);
+    });
+    std::string missing = input.path + ".missing";
+    assertThrows("Error opening " + missing + ": No such file or directory", [&] {
+        getCutJets(testFormat, missing.c_str(), spec, stats);
+    });
+}
+
+static void testScan() {
+    TempFile input(testInput);
+    const char* settings = R"(
+        takeNum: 10
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+        bootstrapReplicas: 3
+        define: PT = VAR_PT * 1
+    )";
+    const char* histograms = R"(
+        VAR_M 0 9.5
+        histogram_ints: VAR_NUM
+        histogram_custom: VAR_M 0 2 5 10
+        histogram_quantiles: VAR_M 2
+    )";
+    GetCutJetsSpec spec(testFormat, std::string(settings) + "new_cut\nscan: PT 10 50 5\n" + histograms);
+    auto result = getCutJets(testFormat, input.path.c_str(), spec);
+    const auto& scanned = result.cutResults[0];
+    assert(vectorsEqual(scanned.scan->thresholds, {10, 20, 30, 40, 50}));
+    assert(scanned.totalJetsTaken == 5);
+
+    // With takeNum above the number of jets, each threshold matches a separate cut
+    auto values = [](const std::map<intmax_t, double>& bins) {
+        std::vector<double> result;
+        for (const auto& [k, v] : bins) {
+            result.push_back(v);
+        }
+        return result;
+    };
+    for (size_t i = 0; i < scanned.scanResults.size(); i++) {
+        std::string cut = "new_cut\nPT " + std::to_string(scanned.scan->thresholds[i]) + " inf\n";
+        auto separate = getCutJets(testFormat, input.path.c_str(),
+                                   GetCutJetsSpec(testFormat, std::string(settings) + cut + histograms));
+        const auto& expected = separate.cutResults[0];
+        const auto& actual = scanned.scanResults[i];
+        assert(actual.totalJetsTaken == expected.totalJetsTaken);
+        assert(scanned.scanWeights[i] == expected.binHistograms[0].totalWeight);
+        assert(vectorsNearlyEqual(values(actual.intHistograms[0].binSums), values(expected.intHistograms[0].binSums)));
+        assert(vectorsNearlyEqual(actual.intHistograms[0].replicaTotals, expected.intHistograms[0].replicaTotals));
+        assert(vectorsNearlyEqual(actual.binHistograms[0].binSums, expected.binHistograms[0].binSums));
+        assert(vectorsNearlyEqual(actual.binHistograms[0].binErrs, expected.binHistograms[0].binErrs));
+        assert(vectorsNearlyEqual(actual.binHistograms[0].replicaSums, expected.binHistograms[0].replicaSums));
+        assert(actual.quantileHistograms[0].totalWeight == expected.quantileHistograms[0].totalWeight);
+    }
+    assert(scanned.scanResults[0].totalJetsTaken == 5 && scanned.scanResults[4].totalJetsTaken == 1);
+
+    assertThrows("Cut can only have one scan", [&] {
+        GetCutJetsSpec(testFormat, std::string(settings) + "new_cut\nscan: PT 10 50 5\nscan: VAR_M 0 1 2\n" + histograms);
+    });
+    assertThrows("Scan must have at least 2 steps from a lower to a higher threshold", [&] {
+        GetCutJetsSpec(testFormat, std::string(settings) + "new_cut\nscan: PT 50 10 5\n" + histograms);
+    });
+}
+
+static void testOutputFormats() {
+    TempFile input(testInput);
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 2
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+        bootstrapReplicas: 3
+        define: THIRD_M = VAR_M / 3
+
+        new_cut
+        scan: VAR_PT 10 50 3
+        histogram_ints: VAR_NUM
+        histogram: THIRD_M 0 1 3
+        histogram_quantiles: VAR_M 2
+    )");
+    auto result = getCutJets(testFormat, input.path.c_str(), spec);
+
+    // The binary format holds every number exactly, so writing what was read back gives the same bytes
+    std::string binary = resultString(result, OutputFormat::Binary);
+    assert(binary.size() % 8 == 0);
+    auto reread = readBinaryResult(binary);
+    assert(resultString(reread, OutputFormat::Binary) == binary);
+    assert(yamlString(reread) == yamlString(result));
+    assert(resultString(reread, OutputFormat::JSON) == resultString(result, OutputFormat::JSON));
+    assert(reread.cutResults[0].scan->varName == "VAR_PT");
+    assert(vectorsEqual(reread.cutResults[0].binHistograms[0].binEndpoints,
+                        result.cutResults[0].binHistograms[0].binEndpoints));
+
+    assertThrows("Binary result is truncated", [&] { readBinaryResult(binary.substr(0, binary.size() - 8)); });
+    assertThrows("Not a binary get_cuts result", [&] { readBinaryResult(yamlString(result)); });
+
+    CutJetsResult small;
+    small.numEvents = 3;
+    small.totalWeight = 1.0 / 3;
+    small.csOnW = NAN;
+    assert(resultString(small, OutputFormat::JSON) ==
+           "{\"num_events\":3,\"total_weight\":0.3333333333333333,\"cs_on_w\":null,\"cuts\":[]}\n");
+    assert(yamlString(small) == "num_events: 3\ntotal_weight: 0.333333\ncs_on_w: nan\ncuts:\n");
+
+    assertThrows("Unknown output format xml; expected yaml, json, or binary", [] { parseOutputFormat("xml"); });
+}
+
+static void testEventStore() {
+    TempFile input(testInput);
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 1
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+
+        new_cut
+        VAR_PT 15 100
+        histogram_ints: GLUON_FLAG_1
+        histogram: VAR_M 0 10 5
+    )");
+
+    CutJetsResult fromFile = getCutJets(testFormat, input.path.c_str(), spec);
+    assert(fromFile.numEvents == 3);
+    assert(fromFile.totalWeight == 0.5 + 2.0 + 1.5);
+    assert(fromFile.csOnW == 4.0 / 4.0);
+    assert(fromFile.cutResults[0].totalJetsTaken == 2);
+
+    EventStore store = loadEvents(testFormat, input.path.c_str());
+    assert(store.numEvents() == 3);
+    assert(store.numJets() == 6);
+    assert(vectorsEqual(store.jetColumns[1], {30, 20, 10, 50, 45, 5}));
+    assert(store.zData[0][2] == 2.0);
+    assert(std::isinf(store.zData[1][0]));
+
+    CutJetsProcessor processor(testFormat, spec);
+    store.replay(processor);
+    CutJetsResult fromStore = processor.finish();
+    assert(fromStore.numEvents == fromFile.numEvents);
+    assert(fromStore.totalWeight == fromFile.totalWeight);
+    assert(fromStore.csOnW == fromFile.csOnW);
+    assert(fromStore.cutResults[0].totalJetsTaken == fromFile.cutResults[0].totalJetsTaken);
+    assert(fromStore.cutResults[0].intHistograms[0].binSums == fromFile.cutResults[0].intHistograms[0].binSums);
+    assert(vectorsEqual(fromStore.cutResults[0].binHistograms[0].binSums, fromFile.cutResults[0].binHistograms[0].binSums));
+}
+
+static void testCutJetsSession() {
+    TempFile input(testInput);
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 1
+        skipNum: 1
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+        bootstrapReplicas: 2
+        define: Z_PT = hypot(Z_PX, Z_PY)
+
+        new_cut
+        VAR_PT 5 100
+        histogram_ints: GLUON_FLAG_1
+        histogram: VAR_M 0 10 5
+
+        new_cut
+        Z_PT 4 5
+        histogram: VAR_PT 0 50 5
+    )");
+    std::string expected = yamlString(getCutJets(testFormat, input.path.c_str(), spec));
+
+    // The events of the test input, as a generator would produce them
+    std::vector<CutJetsSession::Event> events(3);
+    events[0] = {0.5, 2.0, 1, 0, {2, 4, 2, 20, std::log(22.0 / 18) / 2}, 3};
+    events[1] = {2.0, 3.0};
+    events[1].numJets = 2;
+    events[2] = {1.5, 4.0, 0, 0};
+    events[2].numJets = 1;
+    std::vector<double> jets = {0, 30, 1.5, 1, 20, 2.5, 2, 10, 3.5, 0, 50, 4.5, 1, 45, 0.5, 0, 5, 9};
+
+    CutJetsSession session(testFormat, spec);
+    assert(session.numJetValues() == 3);
+    const double* eventJets = jets.data();
+    for (const auto& event : events) {
+        session.pushEvent(event, eventJets);
+        eventJets += event.numJets * session.numJetValues();
+    }
+    auto pushed = session.finish();
+    assert(pushed.numEvents == 3 && pushed.cutResults[1].totalJetsTaken == 1);
+
+    CutJetsSession batched(testFormat, spec);
+    batched.pushEvents(events.data(), 1, jets.data());
+    batched.pushEvents(events.data() + 1, 2, jets.data() + 9);
+    assert(yamlString(batched.finish()) == yamlString(pushed));
+
+    // The event-level data pushed should match what's parsed from the H and M lines
+    EventStore store = loadEvents(testFormat, input.path.c_str());
+    for (size_t i = 0; i < events.size(); i++) {
+        assert(events[i].isGluon1 == store.isGluon1[i] && events[i].isGluon2 == store.isGluon2[i]);
+        assert(std::equal(std::begin(events[i].zData), std::end(events[i].zData), store.zData[i].begin()));
+    }
+    assert(yamlString(pushed) == expected);
+
+    // A jet added as an lvalue keeps its storage, which is what lets the session reuse one buffer
+    CutJetsProcessor processor(testFormat, spec);
+    processor.beginEvent(0, 1, 1);
+    Jet jet = {0, 30, 1.5};
+    jet.reserve(testFormat.numVars() + spec.defines.size());
+    const double* storage = jet.data();
+    assert(!processor.wantJet() && processor.wantJet());  // after skipNum
+    processor.addJet(jet);
+    assert(jet.data() == storage && jet.size() > 3);
+}
+
+static void testMultiSample() {
+    // Every task runs exactly once, even when they're all queued on one thread
+    WorkStealingPool<size_t> pool(3);
+    std::vector<std::atomic<int>> runs(100);
+    for (size_t i = 0; i < runs.size(); i++) {
+        pool.add(0, i);
+    }
+    pool.run([&](size_t task, size_t) { runs[task]++; });
+    assert(std::all_of(runs.begin(), runs.end(), [](const auto& n) { return n == 1; }));
+    WorkStealingPool<size_t> failing(2);
+    failing.add(1, 0);
+    assertThrows("task failed", [&] { failing.run([](size_t, size_t) { throw std::runtime_error("task failed"); }); });
+
+    TempFile first(testInput);
+    TempFile second("header\nNew Event\n1.0, 6.0\n0, 10, 1\nNew Event\n3.0, 6.0\n0, 20, 7\n");
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 5
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 0
+
+        new_cut
+        VAR_PT 0 100
+        histogram_ints: VAR_NUM
+        histogram: VAR_M 0 10 2
+    )");
+
+    // Small chunks split each input into several tasks, but each sample comes out as if it had been run alone
+    auto result = getCutJets(testFormat, {first.path, second.path}, spec, 3, 40);
+    assert(result.numTasks > 2);
+    assert(yamlString(result.samples[0]) == yamlString(getCutJets(testFormat, first.path.c_str(), spec)));
+    assert(yamlString(result.samples[1]) == yamlString(getCutJets(testFormat, second.path.c_str(), spec)));
+    assert(result.samples[0].csOnW == 4.0 / 4.0 && result.samples[1].csOnW == 6.0 / 4.0);
+
+    // The combination weights the first sample's jets by 1 and the second's by 1.5 before normalizing
+    const auto& combined = result.combined;
+    assert(combined.numEvents == 5 && combined.totalWeight == 4 * 1.0 + 4 * 1.5 && combined.csOnW == 1);
+    std::vector<double> values;
+    for (const auto& [k, v] : combined.cutResults[0].intHistograms[0].binSums) {
+        values.push_back(v);
+    }
+    assert(vectorsNearlyEqual(values, {10 / 13.0, 2.5 / 13, 0.5 / 13}));
+    double bin0 = 0.5 * 3 + 2.0 * 2 + 1.0 * 1.5;  // VAR_M below 5
+    double bin1 = 1.5 + 3.0 * 1.5;
+    assert(vectorsNearlyEqual(combined.cutResults[0].binHistograms[0].binSums,
+                              {bin0 / (bin0 + bin1) / 5, bin1 / (bin0 + bin1) / 5}));
+
+    std::string binary = resultString(result, OutputFormat::Binary);
+    size_t pos = 0;
+    assert(yamlString(readBinaryResult(binary, pos)) == yamlString(combined));
+    assert(yamlString(readBinaryResult(binary, pos)) == yamlString(result.samples[0]));
+    assert(yamlString(readBinaryResult(binary, pos)) == yamlString(result.samples[1]));
+    assert(pos == binary.size());
+}
+
+static void testProgressive() {
+    // 400 events with one jet each, split evenly between the two VAR_M bins; the last one alone passes the second cut
+    std::string text = "header\n";
+    for (int i = 0; i < 400; i++) {
+        text += "New Event\n1.0, " + std::string(i == 399 ? "8.0" : "7.0") + "\n0, " +
+                (i == 399 ? "150" : "30") + ", " + (i % 2 ? "7" : "2") + "\n";
+    }
+    TempFile input(text);
+    GetCutJetsSpec spec(testFormat, R"(
+        takeNum: 1
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 5
+
+        new_cut
+        VAR_PT 0 100
+        histogram: VAR_M 0 10 2
+        new_cut
+        VAR_PT 100 200
+        histogram: VAR_PT 100 200 1
+    )");
+    CutJetsResult full = getCutJets(testFormat, input.path.c_str(), spec);
+
+    // Each VAR_M bin has a relative error of 1 / sqrt(jets in it), so about 50 events are enough for 0.2
+    ProgressiveOptions options;
+    options.targetRelativeError = 0.2;
+    options.variables = {"VAR_M"};
+    options.blockBytes = 100;
+    options.blocksPerUpdate = 1;
+    std::vector<double> fractions;
+    options.onUpdate = [&](const CutJetsResult& interim, const ProgressiveStatus& status) {
+        assert(std::abs(interim.cutResults[0].binHistograms[0].binSums[0] * 5 - 0.5) <= 0.5);  // normalized
+        fractions.push_back(status.fractionRead);
+    };
+    ProgressiveStatus status;
+    CutJetsResult early = getCutJets(testFormat, input.path.c_str(), spec, options, status);
+    assert(status.numBlocks > 50 && status.blocksRead < status.numBlocks && status.blocksRead == fractions.size());
+    assert(status.maxRelativeError <= 0.2 && status.fractionRead > 0.05 && status.fractionRead < 0.5);
+    assert(std::is_sorted(fractions.begin(), fractions.end()) && fractions.back() == status.fractionRead);
+    assert(early.numEvents > 40 && early.numEvents < 200 && early.totalWeight == early.numEvents);
+
+    // Every output format reports how much was read; results that read everything don't mention it
+    assert(early.progressive && early.progressive->blocksRead == status.blocksRead);
+    std::string yaml = yamlString(early);
+    assert(yaml.find("\nprogressive:\n  fraction_read: ") != std::string::npos);
+    assert(yaml.find("\n  blocks_read: " + std::to_string(status.blocksRead) + "\n  num_blocks: " +
+                     std::to_string(status.numBlocks) + "\n  max_relative_error: ") != std::string::npos);
+    std::string json = resultString(early, OutputFormat::JSON);
+    assert(json.find(",\"progressive\":{\"fraction_read\":") != std::string::npos);
+    std::string blocksJSON = ",\"blocks_read\":" + std::to_string(status.blocksRead) + ",\"num_blocks\":";
+    assert(json.find(blocksJSON) != std::string::npos);
+    auto reread = readBinaryResult(resultString(early, OutputFormat::Binary));
+    assert(reread.progressive && reread.progressive->numBlocks == status.numBlocks);
+    assert(reread.progressive->fractionRead == status.fractionRead);
+    assert(reread.progressive->maxRelativeError == status.maxRelativeError);
+    assert(yamlString(reread) == yaml);
+    assert(yamlString(full).find("progressive") == std::string::npos);
+    assert(resultString(full, OutputFormat::JSON).find("progressive") == std::string::npos);
+
+    // Watching the second cut's histogram too, which stays empty until the last event is read, reads everything
+    options.variables.clear();
+    options.targetRelativeError = 0;
+    CutJetsResult all = getCutJets(testFormat, input.path.c_str(), spec, options, status);
+    assert(status.blocksRead == status.numBlocks && status.fractionRead == 1);
+    assert(all.numEvents == full.numEvents && all.csOnW == full.csOnW);
+    assert(vectorsNearlyEqual(all.cutResults[0].binHistograms[0].binSums, full.cutResults[0].binHistograms[0].binSums));
+    assert(vectorsNearlyEqual(all.cutResults[1].binHistograms[0].binSums, full.cutResults[1].binHistograms[0].binSums));
+
+    // Bootstrap replicas follow each event's position in the input, not the shuffled order the blocks are read in
+    GetCutJetsSpec bootstrapSpec(testFormat, R"(
+        takeNum: 1
+        skipNum: 0
+        strict: false
+        eventProbabilityMultiplier: nan
+        randomSeed: 5
+        bootstrapReplicas: 4
+
+        new_cut
+        VAR_PT 0 100
+        histogram: VAR_M 0 10 2
+    )");
+    full = getCutJets(testFormat, input.path.c_str(), bootstrapSpec);
+    all = getCutJets(testFormat, input.path.c_str(), bootstrapSpec, options, status);
+    assert(status.blocksRead == status.numBlocks);
+    const auto& replicaErrs = all.cutResults[0].binHistograms[0].binReplicaErrs;
+    assert(replicaErrs.size() == 2 && replicaErrs[0] > 0);
+    assert(vectorsEqual(replicaErrs, full.cutResults[0].binHistograms[0].binReplicaErrs));
+
+    options.variables = {"Z_RAP"};
+    assertThrows("No histogram of Z_RAP in spec", [&] {
+        getCutJets(testFormat, input.path.c_str(), spec, options, status);
+    });
+}
+
+static void testCanonicalSpec() {
+    const char* specText = R"(
+        takeNum: 3
+        skipNum: 1
+        strict: false
+        eventProbabilityMultiplier: 0.1
+        randomSeed: 4
+        define: PT2 = VAR_PT^2
+
+        new_cut
+        VAR_PT 0.3 100
+        histogram_ints: GLUON_FLAG_1
+        histogram: VAR_M 0 1 3
+        histogram_custom: VAR_M 0.1 0.2 0.7
+        histogram_quantiles: VAR_PT 7
+        define: RATIO = VAR_PT / (VAR_M + 1)
+        new_cut
+        RATIO 0 5
+        scan: VAR_PT 10 40 7
+        histogram: RATIO 0 5 5
+    )";
+    GetCutJetsSpec spec(testFormat, specText);
+    std::string canonical = spec.canonical(testFormat);
+    GetCutJetsSpec reparsed(testFormat, std::string(canonical));
+    assert(reparsed.canonical(testFormat) == canonical);
+    assert(reparsed.eventProbabilityMultiplier == 0.1);
+    assert(reparsed.cuts[0].clauses == spec.cuts[0].clauses);
+    assert(vectorsEqual(reparsed.cuts[0].binHistograms[0].binEndpoints, spec.cuts[0].binHistograms[0].binEndpoints));
+    assert(reparsed.cuts[0].quantileHistograms[0].numBins == 7);
+    assert(reparsed.defines.size() == 2);
+    assert(reparsed.cuts[1].clauses[0].varIndex == testFormat.numVars() + 1);
+    assert(vectorsEqual(reparsed.cuts[1].scan->thresholds, spec.cuts[1].scan->thresholds));
+}
+
+static void testCheckpoint() {
+    std::string fullInput = testInput;
+    size_t splitPoint = fullInput.find("New Event\n1.5");
+    TempFile input(fullInput.substr(0, splitPoint + 5));  // ends partway through the last event
+    TempFile checkpoint("");
+    unlink(checkpoint.path.c_str());
+
+    for (const char* sampling : {"nan", "0.6"}) {
+        GetCutJetsSpec spec(testFormat, std::string(R"(
+            takeNum: 2
+            skipNum: 0
+            strict: false
+            eventProbabilityMultiplier: )") + sampling + R"(
+            randomSeed: 3
+            bootstrapReplicas: 4
+
+            new_cut
+            VAR_PT 15 100
+            histogram_ints: GLUON_FLAG_1
+            histogram: VAR_M 0 10 5
+            histogram_quantiles: VAR_PT 2
+        )");
+        std::ofstream(input.path, std::ios::trunc) << fullInput.substr(0, splitPoint + 5);
+
+        CutJetsResult partial = getCutJets(testFormat, input.path.c_str(), spec, checkpoint.path);
+        assert(partial.numEvents <= 2);
+
+        std::ofstream(input.path, std::ios::app) << fullInput.substr(splitPoint + 5);
+        CutJetsResult resumed = getCutJets(testFormat, input.path.c_str(), spec, checkpoint.path);
+        CutJetsResult uninterrupted = getCutJets(testFormat, input.path.c_str(), spec);
+        unlink(checkpoint.path.c_str());
+
+        assert(resumed.numEvents == uninterrupted.numEvents);
+        assert(resumed.totalWeight == uninterrupted.totalWeight);
+        assert(resumed.csOnW == uninterrupted.csOnW || (std::isnan(resumed.csOnW) && std::isnan(uninterrupted.csOnW)));
+        assert(resumed.cutResults[0].totalJetsTaken == uninterrupted.cutResults[0].totalJetsTaken);
+        assert(resumed.cutResults[0].intHistograms[0].binSums == uninterrupted.cutResults[0].intHistograms[0].binSums);
+        assert(vectorsEqual(resumed.cutResults[0].binHistograms[0].binSums, uninterrupted.cutResults[0].binHistograms[0].binSums));
+        assert(vectorsEqual(resumed.cutResults[0].quantileHistograms[0].binEndpoints, uninterrupted.cutResults[0].quantileHistograms[0].binEndpoints));
+        assert(vectorsEqual(resumed.cutResults[0].binHistograms[0].replicaSums, uninterrupted.cutResults[0].binHistograms[0].replicaSums));
+    }
+
+    GetCutJetsSpec otherSpec(testFormat, "takeNum: 1 skipNum: 0 strict: false eventProbabilityMultiplier: nan randomSeed: 0");
+    getCutJets(testFormat, input.path.c_str(), otherSpec, checkpoint.path);
+    GetCutJetsSpec changedSpec(testFormat, "takeNum: 2 skipNum: 0 strict: false eventProbabilityMultiplier: nan randomSeed: 0");
+    assertThrows("Checkpoint was written for a different format or spec", [&]{
+        getCutJets(testFormat, input.path.c_str(), changedSpec, checkpoint.path);
+    });
+}
+
 void runTests() {
     testParseSpec();
     testIntHistogram();
     testBinHistogram();
     testCustomHistogram();
+    testQuantileHistogram();
+    testBootstrap();
+    testHistogramArena();
+    testCpuKernels();
+    testExpression();
+    testDerivedVariables();
+    testEventClauses();
+    testManyCuts();
+    testJetDump();
+    testResultCache();
+    testZoneMap();
+    testPipeline();
+    testScan();
+    testOutputFormats();
+    testEventStore();
+    testCutJetsSession();
+    testMultiSample();
+    testProgressive();
+    testCanonicalSpec();
+    testCheckpoint();
     std::cout << "All tests passed!" << std::endl;
 }